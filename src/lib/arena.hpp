@@ -0,0 +1,153 @@
+/*
+ * Copyright (c) 2018 https://github.com/dscat/cuitool
+ *
+ * Licensed under the MIT License: http://www.opensource.org/licenses/mit-license.php
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef DSCAT_LIB_ARENA_HPP
+#define DSCAT_LIB_ARENA_HPP
+
+#include <cstdint>
+#include <mutex>
+#include <vector>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "stats.hpp"
+
+namespace dscat {
+
+    // arena
+    //  One anonymous mapping cut into equal slots on page boundaries. Slots
+    //  are taken and given back through a free list, so the buffers of a job
+    //  are allocated once and every chunk after that reuses them. On request
+    //  the mapping is made of reserved huge pages, or of transparent huge
+    //  pages when none are reserved.
+    class arena {
+
+    public:
+
+        static constexpr size_t align = 4096;
+        static constexpr size_t hugepage = 2 << 20;
+
+        // a piece of a slot
+        struct span {
+            char* p = nullptr;
+            size_t n = 0;
+            char* data() const { return p; }
+            size_t size() const { return n; }
+            char& operator[](size_t i) const { return p[i]; }
+        };
+
+        arena() = default;
+        arena(const arena&) = delete;
+        arena& operator=(const arena&) = delete;
+        ~arena() { clear(); }
+
+        // map `count` slots of at least `size` bytes (the previous slots are gone)
+        //  returns 0, -1 when the mapping failed
+        int reserve(size_t size, size_t count, bool huge = false) {
+            clear();
+            if (size == 0 || count == 0) return 0;
+            slot = (size + align - 1) / align * align;
+            length = slot * count;
+            void* m = MAP_FAILED;
+#ifdef MAP_HUGETLB
+            if (huge) {
+                size_t hl = (length + hugepage - 1) / hugepage * hugepage;
+                m = mmap(nullptr, hl, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+                if (m != MAP_FAILED) {
+                    length = hl;
+                    explicithuge = true;
+                }
+            }
+#endif
+            if (m == MAP_FAILED) m = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (m == MAP_FAILED) {
+                length = slot = 0;
+                return -1;
+            }
+#ifdef MADV_HUGEPAGE
+            if (huge && !explicithuge) madvise(m, length, MADV_HUGEPAGE);
+#endif
+            base = static_cast<char*>(m);
+            memory::acquire(length);
+            for (size_t i = count; i > 0; i--) avail.push_back(base + (i - 1) * slot);
+            nslots = count;
+            return 0;
+        }
+
+        // place the slots on NUMA node `id` if possible (before they are touched)
+        void prefer(int id) {
+#if defined(__linux__) && defined(SYS_mbind)
+            const int bits = 8 * sizeof(unsigned long);
+            unsigned long mask[1024 / bits] = {0};
+            if (base == nullptr || id < 0 || id >= 1023) return;
+            mask[id / bits] = 1UL << (id % bits);
+            syscall(SYS_mbind, base, length, 1 /* MPOL_PREFERRED */, mask, 1024UL, 0U); // best effort
+#endif
+        }
+
+        void clear() {
+            std::lock_guard<std::mutex> lk(mtx);
+            if (base != nullptr) {
+                munmap(base, length);
+                memory::release(length);
+            }
+            base = nullptr;
+            length = slot = nslots = 0;
+            explicithuge = false;
+            avail.clear();
+        }
+
+        // a free slot, nullptr when all are taken
+        char* take() {
+            std::lock_guard<std::mutex> lk(mtx);
+            if (avail.empty()) return nullptr;
+            char* p = avail.back();
+            avail.pop_back();
+            return p;
+        }
+
+        void give(char* p) {
+            std::lock_guard<std::mutex> lk(mtx);
+            avail.push_back(p);
+        }
+
+        size_t slotSize() const { return slot; }
+        size_t slots() const { return nslots; }
+        // the slots are on reserved huge pages
+        bool huge() const { return explicithuge; }
+
+    private:
+
+        char* base = nullptr;
+        size_t length = 0, slot = 0, nslots = 0;
+        bool explicithuge = false;
+        std::vector<char*> avail; // reserved for every slot, so give() never allocates
+        std::mutex mtx;
+
+    };
+
+} // ns::dscat
+
+#endif //DSCAT_LIB_ARENA_HPP
@@ -0,0 +1,246 @@
+/*
+ * Copyright (c) 2018 https://github.com/dscat/cuitool
+ *
+ * Licensed under the MIT License: http://www.opensource.org/licenses/mit-license.php
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef DSCAT_LIB_COMPRESS_HPP
+#define DSCAT_LIB_COMPRESS_HPP
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#ifdef DSCAT_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+namespace dscat {
+
+    // codec
+    //  Block compression for the stream before it is scattered. lz4 is built in
+    //  (an LZ4 block format encoder/decoder), zstd is used when it was found at
+    //  build time (DSCAT_HAVE_ZSTD).
+    class codec {
+
+    public:
+
+        enum kind { STORED = 0, LZ4 = 1, ZSTD = 2 };
+
+        // parse a codec name, returns -1 when unknown or not built in
+        static int parse(const std::string& name, kind& k) {
+            if (name == "lz4") k = LZ4;
+#ifdef DSCAT_HAVE_ZSTD
+            else if (name == "zstd") k = ZSTD;
+#endif
+            else return -1;
+            return 0;
+        }
+
+        static const char* name(kind k) {
+            switch (k) {
+                case LZ4: return "lz4";
+                case ZSTD: return "zstd";
+                default: return "stored";
+            }
+        }
+
+        // Shannon entropy in bits per byte, sampled on large blocks
+        static double entropy(const char* src, size_t n) {
+            if (n == 0) return 0;
+            size_t step = n > 65536 ? n / 65536 : 1;
+            uint32_t hist[256] = {0};
+            size_t total = 0;
+            for (size_t i = 0; i < n; i += step, total++) hist[static_cast<uint8_t>(src[i])]++;
+            double e = 0;
+            for (auto h : hist) {
+                if (h == 0) continue;
+                double p = static_cast<double>(h) / total;
+                e -= p * std::log2(p);
+            }
+            return e;
+        }
+
+        // compress into dst, -1 when the result would not be smaller than the source
+        static int compress(kind k, const char* src, size_t n, char* dst, size_t cap, size_t& clen) {
+            if (cap > n) cap = n; // no gain otherwise
+            switch (k) {
+                case LZ4:
+                    return lz4compress(reinterpret_cast<const uint8_t*>(src), n, reinterpret_cast<uint8_t*>(dst), cap, clen);
+#ifdef DSCAT_HAVE_ZSTD
+                case ZSTD: {
+                    size_t r = ZSTD_compress(dst, cap, src, n, 3);
+                    if (ZSTD_isError(r) || r >= n) return -1;
+                    clen = r;
+                    return 0;
+                }
+#endif
+                default:
+                    return -1;
+            }
+        }
+
+        // decompress exactly rlen bytes, -1 on corrupt input
+        static int decompress(kind k, const char* src, size_t n, char* dst, size_t rlen) {
+            switch (k) {
+                case STORED:
+                    if (n != rlen) return -1;
+                    std::memcpy(dst, src, n);
+                    return 0;
+                case LZ4:
+                    return lz4decompress(reinterpret_cast<const uint8_t*>(src), n, reinterpret_cast<uint8_t*>(dst), rlen);
+#ifdef DSCAT_HAVE_ZSTD
+                case ZSTD: {
+                    size_t r = ZSTD_decompress(dst, rlen, src, n);
+                    return ZSTD_isError(r) || r != rlen ? -1 : 0;
+                }
+#endif
+                default:
+                    return -1;
+            }
+        }
+
+    private:
+
+        static uint32_t read32(const uint8_t* p) {
+            uint32_t v;
+            std::memcpy(&v, p, 4);
+            return v;
+        }
+
+        static void length(uint8_t*& op, size_t l) {
+            for (; l >= 255; l -= 255) *op++ = 255;
+            *op++ = static_cast<uint8_t>(l);
+        }
+
+        // greedy LZ4 block encoder with a 4096 entry hash table
+        static int lz4compress(const uint8_t* src, size_t n, uint8_t* dst, size_t cap, size_t& clen) {
+            const size_t minmatch = 4, lastliterals = 5, mflimit = 12;
+            uint32_t table[4096] = {0};
+            const uint8_t* ip = src;
+            const uint8_t* anchor = src;
+            const uint8_t* iend = src + n;
+            uint8_t* op = dst;
+            uint8_t* oend = dst + cap;
+
+            auto emit = [&](const uint8_t* lit, size_t litlen, size_t offset, size_t mlen, bool final) {
+                size_t need = 1 + litlen + litlen / 255 + 1 + (final ? 0 : 2 + mlen / 255 + 1);
+                if (static_cast<size_t>(oend - op) < need) return false;
+                uint8_t* token = op++;
+                *token = static_cast<uint8_t>((litlen >= 15 ? 15 : litlen) << 4);
+                if (litlen >= 15) length(op, litlen - 15);
+                std::memcpy(op, lit, litlen);
+                op += litlen;
+                if (final) return true;
+                *op++ = static_cast<uint8_t>(offset);
+                *op++ = static_cast<uint8_t>(offset >> 8);
+                *token |= static_cast<uint8_t>(mlen >= 15 ? 15 : mlen);
+                if (mlen >= 15) length(op, mlen - 15);
+                return true;
+            };
+
+            if (n > mflimit) {
+                const uint8_t* limit = iend - mflimit;
+                const uint8_t* matchlimit = iend - lastliterals;
+                ip++;
+                while (ip < limit) {
+                    uint32_t seq = read32(ip);
+                    uint32_t h = (seq * 2654435761u) >> 20;
+                    const uint8_t* ref = src + table[h];
+                    table[h] = static_cast<uint32_t>(ip - src);
+                    if (ref >= ip || ip - ref > 65535 || read32(ref) != seq) {
+                        ip += 1 + ((ip - anchor) >> 6); // skip faster over incompressible runs
+                        continue;
+                    }
+                    while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+                        ip--;
+                        ref--;
+                    }
+                    const uint8_t* mp = ip + minmatch;
+                    const uint8_t* rp = ref + minmatch;
+                    while (mp < matchlimit && *mp == *rp) {
+                        mp++;
+                        rp++;
+                    }
+                    if (!emit(anchor, ip - anchor, ip - ref, mp - ip - minmatch, false)) return -1;
+                    ip = mp;
+                    anchor = ip;
+                }
+            }
+            if (!emit(anchor, iend - anchor, 0, 0, true)) return -1;
+            clen = op - dst;
+            return clen < n ? 0 : -1;
+        }
+
+        static int lz4decompress(const uint8_t* src, size_t n, uint8_t* dst, size_t rlen) {
+            const uint8_t* ip = src;
+            const uint8_t* iend = src + n;
+            uint8_t* op = dst;
+            uint8_t* oend = dst + rlen;
+            while (ip < iend) {
+                uint8_t token = *ip++;
+                size_t litlen = token >> 4;
+                if (litlen == 15) {
+                    uint8_t b;
+                    do {
+                        if (ip >= iend) return -1;
+                        b = *ip++;
+                        litlen += b;
+                    } while (b == 255);
+                }
+                if (litlen > static_cast<size_t>(iend - ip) || litlen > static_cast<size_t>(oend - op)) return -1;
+                std::memcpy(op, ip, litlen);
+                op += litlen;
+                ip += litlen;
+                if (ip == iend) break; // last literals
+                if (iend - ip < 2) return -1;
+                size_t offset = ip[0] | (ip[1] << 8);
+                ip += 2;
+                if (offset == 0 || offset > static_cast<size_t>(op - dst)) return -1;
+                size_t mlen = token & 15;
+                if (mlen == 15) {
+                    uint8_t b;
+                    do {
+                        if (ip >= iend) return -1;
+                        b = *ip++;
+                        mlen += b;
+                    } while (b == 255);
+                }
+                mlen += 4;
+                if (mlen > static_cast<size_t>(oend - op)) return -1;
+                const uint8_t* m = op - offset;
+                if (offset >= mlen) {
+                    std::memcpy(op, m, mlen);
+                    op += mlen;
+                } else {
+                    for (size_t i = 0; i < mlen; i++) *op++ = *m++; // overlapping copy
+                }
+            }
+            return op == oend ? 0 : -1;
+        }
+
+    };
+
+} // ns::dscat
+
+#endif //DSCAT_LIB_COMPRESS_HPP
@@ -26,52 +26,302 @@
 #ifndef DSCAT_CUILOG_HPP
 #define DSCAT_CUILOG_HPP
 
-#include <iomanip>
+#include <atomic>
+#include <condition_variable>
+#include <ctime>
+#include <fstream>
 #include <iostream>
-#include <sstream>
+#include <mutex>
+#include <string>
+#include <thread>
 #include "colorstreams.hpp"
 
 namespace cuilog {
 
-    // nullcout
-    class nullstreambuf : public std::streambuf {
-        virtual int overflow(char c) { return traits_type::not_eof(c); }
+    // datetime (formatted once per second)
+    const std::string& datetime(time_t t) {
+        static thread_local time_t last = -1;
+        static thread_local std::string cached;
+        if (t != last) {
+            tm lt;
+            char buf[32];
+            localtime_r(&t, &lt);
+            strftime(buf, sizeof(buf), "(%Y/%m/%d %H:%M:%S)", &lt);
+            cached = buf;
+            last = t;
+        }
+        return cached;
+    }
+    const std::string& datetime() { return datetime(time(nullptr)); }
+
+    // record
+    //  note()/warn()/crit()/info() only capture their argument. The timestamp
+    //  and colors are produced when the record is inserted into a good stream.
+    enum level { NOTE = 0, INFO, WARN, CRIT };
+    template <typename T> struct record {
+        level lv;
+        T str;
+    };
+    template <typename T> inline record<T> note(const T __str) { return record<T>{NOTE, __str}; }
+    template <typename T> inline record<T> warn(const T __str) { return record<T>{WARN, __str}; }
+    template <typename T> inline record<T> crit(const T __str) { return record<T>{CRIT, __str}; }
+    template <typename T> inline record<T> info(const T __str) { return record<T>{INFO, __str}; }
+
+    template <typename T> void render(std::ostream& os, time_t t, const record<T>& r) {
+        switch (r.lv) {
+            case NOTE: os << datetime(t) << " [ ] " << r.str; break;
+            case WARN: os << datetime(t) << " [!] " << ansi::yellow(r.str); break;
+            case CRIT: os << ansi::bright(ansi::red(std::string(datetime(t)).append(" [*] ").append(r.str))); break;
+            case INFO: os << datetime(t) << ansi::cyan(std::string(" [-] ").append(r.str)); break;
+        }
+    }
+
+    template <typename T> std::ostream& operator<<(std::ostream& os, const record<T>& r) {
+        if (os.good()) render(os, time(nullptr), r);
+        return os;
+    }
+
+    // logger
+    //  Threads push finished lines into a lock-free MPSC queue (Vyukov) and a
+    //  single background thread renders them to the sinks, so a worker never
+    //  waits on terminal or file I/O. The thread starts with the first line.
+    class logger {
+
+    public:
+
+        typedef struct entry {
+            std::atomic<entry*> next{nullptr};
+            level lv = NOTE;
+            bool rec = false; // head holds a record text
+            time_t t = 0;
+            unsigned tid = 0;
+            std::string head, tail;
+        } entry;
+
+        static logger& get() {
+            static logger inst;
+            return inst;
+        }
+
+        ~logger() {
+            if (worker.joinable()) {
+                stopping = true;
+                wake.notify_one();
+                worker.join();
+            }
+            if (ofs.is_open()) ofs.close();
+        }
+
+        // sinks and filtering (set up before logging from workers)
+        void terminal(bool on) { toterm = on; }
+        int file(const std::string& path) {
+            ofs.open(path, std::ios::out | std::ios::app);
+            return ofs.is_open() ? 0 : -1;
+        }
+        void json(bool on) { tojson = on; }
+        void threshold(level lv) { minlv = lv; }
+        level threshold() const { return minlv; }
+        bool enabled() const { return toterm || ofs.is_open(); }
+
+        // enqueue a line, never blocks on I/O
+        void push(entry* e) {
+            std::call_once(started, [this]() { worker = std::thread(&logger::drain, this); });
+            e->next.store(nullptr, std::memory_order_relaxed);
+            entry* prev = head.exchange(e, std::memory_order_acq_rel);
+            prev->next.store(e, std::memory_order_release);
+            pushed.fetch_add(1, std::memory_order_release);
+            if (idle.load(std::memory_order_acquire)) wake.notify_one();
+        }
+
+        // wait until everything pushed so far has been written
+        void flush() {
+            uint64_t target = pushed.load(std::memory_order_acquire);
+            if (target == 0) return;
+            std::unique_lock<std::mutex> lk(mtx);
+            wake.notify_one();
+            done.wait(lk, [&]() { return written.load(std::memory_order_acquire) >= target; });
+        }
+
+        static unsigned threadId() {
+            static std::atomic<unsigned> seq{0};
+            static thread_local unsigned id = ++seq;
+            return id;
+        }
+
+    private:
+
+        logger() : head(&stub), tail(&stub) {}
+
+        entry* pop() {
+            entry* t = tail;
+            entry* next = t->next.load(std::memory_order_acquire);
+            if (t == &stub) {
+                if (next == nullptr) return nullptr;
+                tail = next;
+                t = next;
+                next = next->next.load(std::memory_order_acquire);
+            }
+            if (next != nullptr) {
+                tail = next;
+                return t;
+            }
+            if (t != head.load(std::memory_order_acquire)) return nullptr; // a producer is mid-push
+            stub.next.store(nullptr, std::memory_order_relaxed);
+            entry* prev = head.exchange(&stub, std::memory_order_acq_rel);
+            prev->next.store(&stub, std::memory_order_release);
+            next = t->next.load(std::memory_order_acquire);
+            if (next != nullptr) {
+                tail = next;
+                return t;
+            }
+            return nullptr;
+        }
+
+        static void escape(std::ostream& os, const std::string& s) {
+            for (unsigned char c : s) {
+                if (c == '"' || c == '\\') os << '\\' << c;
+                else if (c == '\n') os << "\\n";
+                else if (c == '\t') os << "\\t";
+                else if (c < 0x20) {
+                    const char* hex = "0123456789abcdef";
+                    os << "\\u00" << hex[c >> 4] << hex[c & 0xf];
+                }
+                else os << c;
+            }
+        }
+
+        void write(std::ostream& os, const entry& e, bool color) {
+            if (tojson) {
+                static const char* names[] = {"note", "info", "warn", "crit"};
+                std::string dt = datetime(e.t);
+                os << "{\"time\":\"" << dt.substr(1, dt.size() - 2) << "\",\"level\":\"" << names[e.lv]
+                   << "\",\"thread\":" << e.tid << ",\"message\":\"";
+                escape(os, e.head);
+                escape(os, e.tail);
+                os << "\"}\n";
+            } else {
+                if (!e.rec) os << e.tail << '\n';
+                else if (color) {
+                    render(os, e.t, record<std::string>{e.lv, e.head});
+                    os << e.tail << '\n';
+                } else {
+                    static const char* tags[] = {" [ ] ", " [-] ", " [!] ", " [*] "};
+                    os << datetime(e.t) << tags[e.lv] << e.head << e.tail << '\n';
+                }
+            }
+        }
+
+        void drain() {
+            for (;;) {
+                uint64_t n = 0;
+                while (entry* e = pop()) {
+                    if (toterm) write(std::cout, *e, !tojson);
+                    if (ofs.is_open()) write(ofs, *e, false);
+                    delete e;
+                    n++;
+                }
+                if (n != 0) {
+                    if (toterm) std::cout.flush();
+                    if (ofs.is_open()) ofs.flush();
+                    {
+                        std::lock_guard<std::mutex> lk(mtx);
+                        written.fetch_add(n, std::memory_order_release);
+                    }
+                    done.notify_all();
+                    continue;
+                }
+                if (stopping && written.load() >= pushed.load()) return;
+                std::unique_lock<std::mutex> lk(mtx);
+                idle = true;
+                wake.wait_for(lk, std::chrono::milliseconds(10));
+                idle = false;
+            }
+        }
+
+        // queue
+        entry stub;
+        std::atomic<entry*> head;
+        entry* tail;
+        std::atomic<uint64_t> pushed{0}, written{0};
+
+        // drainer
+        std::once_flag started;
+        std::thread worker;
+        std::mutex mtx;
+        std::condition_variable wake, done;
+        std::atomic<bool> idle{false}, stopping{false};
+
+        // sinks
+        bool toterm = true, tojson = false;
+        level minlv = NOTE;
+        std::ofstream ofs;
+
     };
-    class nullostream : public std::ostream {
-        nullstreambuf nullostr;
+
+    // line buffer, one per thread
+    class linebuf : public std::streambuf {
+        logger::entry* e = nullptr;
+        logger::entry& cur() {
+            if (e == nullptr) e = new logger::entry();
+            return *e;
+        }
     public:
-        nullostream() : std::ostream(&nullostr){};
+        ~linebuf() { delete e; }
+        void begin(level lv, const std::string& head) {
+            auto& c = cur();
+            c.lv = lv;
+            c.rec = true;
+            c.t = time(nullptr);
+            c.head = head;
+        }
+    protected:
+        int overflow(int c) override {
+            if (c == traits_type::eof()) return traits_type::not_eof(c);
+            if (c == '\n') {
+                auto& l = cur();
+                if (!l.rec) l.t = time(nullptr);
+                l.tid = logger::threadId();
+                logger::get().push(e);
+                e = nullptr;
+            } else {
+                cur().tail += static_cast<char>(c);
+            }
+            return c;
+        }
+        std::streamsize xsputn(const char* s, std::streamsize n) override {
+            for (std::streamsize i = 0; i < n; i++) overflow(traits_type::to_int_type(s[i]));
+            return n;
+        }
     };
+
+    // cout
+    //  One instance per thread, feeding the logger line by line. Detaching the
+    //  streambuf sets badbit, so while disabled (or below the threshold) every
+    //  insertion fails at its sentry and nothing is formatted.
     class coutclass : public std::basic_ostream<char> {
-        cuilog::nullostream nullcout;
+        linebuf line;
     public:
-        using std::ostream::basic_ostream;
-        coutclass() : std::ostream(std::cout.rdbuf()){};
-        void disable() { this->rdbuf(nullcout.rdbuf()); }
-        void enable()  { this->rdbuf(std::cout.rdbuf()); }
+        coutclass() : std::ostream(nullptr) { attach(); }
+        void attach()  { this->rdbuf(logger::get().enabled() ? &line : nullptr); }
+        void disable() { logger::get().terminal(false); attach(); }
+        void enable()  { logger::get().terminal(true); attach(); }
+        bool enabled() const { return this->rdbuf() != nullptr; }
+        int logfile(const std::string& path) { int ret = logger::get().file(path); attach(); return ret; }
+        template <typename T> friend std::ostream& operator<<(coutclass& os, const record<T>& r) {
+            os.clear(); // a new line starts at each record
+            if (!os.good()) return os;
+            if (r.lv < logger::get().threshold()) {
+                os.setstate(std::ios::badbit);
+                return os;
+            }
+            os.line.begin(r.lv, std::string("").append(r.str));
+            return os;
+        }
     };
-    coutclass cout;
-
-    // datetime
-    std::string datetime() {
-        time_t t = time(nullptr);
-        const tm* lt = localtime(&t);
-
-        std::stringstream out;
-        out << "20" << std::setw(2) << std::setfill('0') << (lt->tm_year - 100) << "/" \
-            << std::setw(2) << std::setfill('0') << (lt->tm_mon + 1) << "/" \
-            << std::setw(2) << std::setfill('0') << lt->tm_mday << " " \
-            << std::setw(2) << std::setfill('0') << lt->tm_hour << ":" \
-            << std::setw(2) << std::setfill('0') << lt->tm_min << ":" \
-            << std::setw(2) << std::setfill('0') << lt->tm_sec;
-        return "(" + out.str() + ")";
-    }
+    thread_local coutclass cout;
 
-    // logger
-    template <typename T> inline std::string note(const T __str) { return std::string(datetime()).append(" [ ] ").append(__str); }
-    template <typename T> inline std::string warn(const T __str) { return std::string(datetime()).append(" [!] ").append(ansi::yellow(__str)); }
-    template <typename T> inline std::string crit(const T __str) { return std::string("").append(ansi::bright(ansi::red(datetime().append(" [*] ").append(__str)))); }
-    template <typename T> inline std::string info(const T __str) { return std::string(datetime()).append(ansi::cyan(std::string(" [-] ").append(__str))); }
+    // wait for queued lines to reach the sinks
+    void flush() { logger::get().flush(); }
 
 }
 
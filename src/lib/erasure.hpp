@@ -0,0 +1,225 @@
+/*
+ * Copyright (c) 2018 https://github.com/dscat/cuitool
+ *
+ * Licensed under the MIT License: http://www.opensource.org/licenses/mit-license.php
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef DSCAT_LIB_ERASURE_HPP
+#define DSCAT_LIB_ERASURE_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define DSCAT_ERASURE_X86
+#endif
+
+namespace dscat {
+
+    // erasure
+    //  Systematic Reed-Solomon over GF(2^8) (polynomial 0x11d) for `k` data
+    //  pieces and `m` parity pieces: any k of the k+m pieces rebuild the data.
+    //  The parity rows are a Cauchy matrix with its columns scaled so that the
+    //  first row is all ones, i.e. the first parity piece is the plain XOR.
+    class erasure {
+
+    public:
+
+        static constexpr size_t maxparity = 8;
+
+        erasure(size_t k = 1, size_t m = 0) : k(k), m(m) {
+            rows.assign(m, std::vector<uint8_t>(k));
+            for (size_t j = 0; j < m; j++) {
+                for (size_t i = 0; i < k; i++) {
+                    // x_j = j, y_i = m + i : 1 / (x_j + y_i), column scaled by (x_0 + y_i)
+                    uint8_t y = static_cast<uint8_t>(m + i);
+                    rows[j][i] = mul(inv(static_cast<uint8_t>(j) ^ y), y);
+                }
+            }
+        }
+
+        size_t data() const { return k; }
+        size_t parity() const { return m; }
+
+        // parity[j] = sum_i rows[j][i] * data[i] over `len` bytes
+        void encode(const char* const* src, char* const* dst, size_t len) const {
+            for (size_t j = 0; j < m; j++) {
+                std::memset(dst[j], 0, len);
+                for (size_t i = 0; i < k; i++) mulAdd(rows[j][i], src[i], dst[j], len);
+            }
+        }
+
+        // choose the decoding for the pieces in `use` (k ascending piece indices)
+        //  returns 0, -1 when a decoding is not possible
+        int prepare(const std::vector<size_t>& use) {
+            if (use.size() != k) return -1;
+            this->use = use;
+            lost.clear();
+            for (size_t i = 0; i < k; i++) {
+                if (std::find(use.begin(), use.end(), i) == use.end()) lost.push_back(i);
+            }
+            if (lost.empty()) return 0;
+
+            // rows of the generator for the pieces in use, inverted by Gauss-Jordan
+            std::vector<std::vector<uint8_t>> a(k, std::vector<uint8_t>(2 * k, 0));
+            for (size_t r = 0; r < k; r++) {
+                size_t p = use[r];
+                if (p >= k + m) return -1;
+                for (size_t c = 0; c < k; c++) a[r][c] = p < k ? (p == c ? 1 : 0) : rows[p - k][c];
+                a[r][k + r] = 1;
+            }
+            for (size_t c = 0; c < k; c++) {
+                size_t piv = c;
+                while (piv < k && a[piv][c] == 0) piv++;
+                if (piv == k) return -1;
+                std::swap(a[piv], a[c]);
+                uint8_t f = inv(a[c][c]);
+                for (auto& v : a[c]) v = mul(v, f);
+                for (size_t r = 0; r < k; r++) {
+                    if (r == c || a[r][c] == 0) continue;
+                    uint8_t g = a[r][c];
+                    for (size_t x = 0; x < 2 * k; x++) a[r][x] ^= mul(g, a[c][x]);
+                }
+            }
+            decode.clear();
+            for (auto i : lost) decode.push_back(std::vector<uint8_t>(a[i].begin() + k, a[i].end()));
+            return 0;
+        }
+
+        // data pieces that prepare() found missing
+        const std::vector<size_t>& missing() const { return lost; }
+
+        // rebuild the missing data pieces; bufs is indexed by piece (k+m entries)
+        void rebuild(char* const* bufs, size_t len) const {
+            for (size_t l = 0; l < lost.size(); l++) {
+                char* dst = bufs[lost[l]];
+                std::memset(dst, 0, len);
+                for (size_t r = 0; r < k; r++) mulAdd(decode[l][r], bufs[use[r]], dst, len);
+            }
+        }
+
+        // GF(2^8) arithmetic
+        static uint8_t mul(uint8_t a, uint8_t b) {
+            if (a == 0 || b == 0) return 0;
+            const tables& t = tab();
+            return t.exp[t.log[a] + t.log[b]];
+        }
+        static uint8_t inv(uint8_t a) {
+            const tables& t = tab();
+            return a == 0 ? 0 : t.exp[255 - t.log[a]];
+        }
+
+        // dst ^= c * src
+        static void mulAdd(uint8_t c, const char* src, char* dst, size_t len) {
+            if (c == 0) return;
+            const uint8_t* s = reinterpret_cast<const uint8_t*>(src);
+            uint8_t* d = reinterpret_cast<uint8_t*>(dst);
+            if (c == 1) {
+                for (size_t i = 0; i < len; i++) d[i] ^= s[i];
+                return;
+            }
+            // products of the low and high nibbles, looked up 16/32 bytes at a time
+            uint8_t lo[16], hi[16];
+            for (int x = 0; x < 16; x++) {
+                lo[x] = mul(c, static_cast<uint8_t>(x));
+                hi[x] = mul(c, static_cast<uint8_t>(x << 4));
+            }
+            size_t i = 0;
+#ifdef DSCAT_ERASURE_X86
+            static const int level = __builtin_cpu_supports("avx2") ? 2 : __builtin_cpu_supports("ssse3") ? 1 : 0;
+            if (level == 2) i = mulAddAvx2(lo, hi, s, d, len);
+            else if (level == 1) i = mulAddSsse3(lo, hi, s, d, len);
+#endif
+            for (; i < len; i++) d[i] ^= lo[s[i] & 0x0f] ^ hi[s[i] >> 4];
+        }
+
+    private:
+
+        typedef struct {
+            uint8_t exp[512];
+            uint8_t log[256];
+        } tables;
+
+        static const tables& tab() {
+            static const tables t = []() {
+                tables t;
+                unsigned x = 1;
+                for (int i = 0; i < 255; i++) {
+                    t.exp[i] = static_cast<uint8_t>(x);
+                    t.log[x] = static_cast<uint8_t>(i);
+                    x <<= 1;
+                    if (x & 0x100) x ^= 0x11d;
+                }
+                for (int i = 255; i < 512; i++) t.exp[i] = t.exp[i - 255];
+                t.log[0] = 0;
+                return t;
+            }();
+            return t;
+        }
+
+#ifdef DSCAT_ERASURE_X86
+        __attribute__((target("ssse3")))
+        static size_t mulAddSsse3(const uint8_t* lo, const uint8_t* hi, const uint8_t* s, uint8_t* d, size_t len) {
+            const __m128i tl = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lo));
+            const __m128i th = _mm_loadu_si128(reinterpret_cast<const __m128i*>(hi));
+            const __m128i mask = _mm_set1_epi8(0x0f);
+            size_t i = 0;
+            for (; i + 16 <= len; i += 16) {
+                __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+                __m128i p = _mm_xor_si128(_mm_shuffle_epi8(tl, _mm_and_si128(x, mask)),
+                                          _mm_shuffle_epi8(th, _mm_and_si128(_mm_srli_epi64(x, 4), mask)));
+                __m128i* o = reinterpret_cast<__m128i*>(d + i);
+                _mm_storeu_si128(o, _mm_xor_si128(_mm_loadu_si128(o), p));
+            }
+            return i;
+        }
+
+        __attribute__((target("avx2")))
+        static size_t mulAddAvx2(const uint8_t* lo, const uint8_t* hi, const uint8_t* s, uint8_t* d, size_t len) {
+            const __m256i tl = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(lo)));
+            const __m256i th = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(hi)));
+            const __m256i mask = _mm256_set1_epi8(0x0f);
+            size_t i = 0;
+            for (; i + 32 <= len; i += 32) {
+                __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + i));
+                __m256i p = _mm256_xor_si256(_mm256_shuffle_epi8(tl, _mm256_and_si256(x, mask)),
+                                             _mm256_shuffle_epi8(th, _mm256_and_si256(_mm256_srli_epi64(x, 4), mask)));
+                __m256i* o = reinterpret_cast<__m256i*>(d + i);
+                _mm256_storeu_si256(o, _mm256_xor_si256(_mm256_loadu_si256(o), p));
+            }
+            return i;
+        }
+#endif
+
+        size_t k, m;
+        std::vector<std::vector<uint8_t>> rows;   // parity rows of the generator
+        std::vector<size_t> use, lost;
+        std::vector<std::vector<uint8_t>> decode; // rows rebuilding the lost pieces
+
+    };
+
+} // ns::dscat
+
+#endif //DSCAT_LIB_ERASURE_HPP
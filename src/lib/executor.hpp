@@ -0,0 +1,280 @@
+/*
+ * Copyright (c) 2018 https://github.com/dscat/cuitool
+ *
+ * Licensed under the MIT License: http://www.opensource.org/licenses/mit-license.php
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef DSCAT_LIB_EXECUTOR_HPP
+#define DSCAT_LIB_EXECUTOR_HPP
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sched.h>
+
+namespace dscat {
+
+    // executor
+    //  Threads that are started once and run the tasks of every job (pipeline
+    //  stages, I/O batches); a task never waits for a free thread, the pool
+    //  grows instead, so stages that block on each other cannot deadlock.
+    //  The default worker count is what this process may really use: the CPUs
+    //  of its affinity mask, bounded by the cgroup CPU quota. Tasks can be
+    //  pinned to CPUs (affinity) and kept on the CPUs of one NUMA node (numa),
+    //  where the buffers of their job are placed.
+    class executor {
+
+    public:
+
+        // threads 0 is available()
+        explicit executor(unsigned threads = 0, bool affinity = false, bool numa = false) : pin(affinity) {
+            CPU_ZERO(&all);
+            if (sched_getaffinity(0, sizeof(all), &all) != 0) {
+                for (unsigned c = 0; c < std::max(1u, std::thread::hardware_concurrency()) && c < CPU_SETSIZE; c++) CPU_SET(c, &all);
+            }
+            std::vector<int> allowed;
+            for (int c = 0; c < CPU_SETSIZE; c++) if (CPU_ISSET(c, &all)) allowed.push_back(c);
+            std::ifstream online("/sys/devices/system/node/online");
+            std::string list;
+            if (numa && std::getline(online, list)) {
+                for (int n : parseList(list)) {
+                    std::ifstream f("/sys/devices/system/node/node" + std::to_string(n) + "/cpulist");
+                    std::string cpus;
+                    if (!std::getline(f, cpus)) continue;
+                    node x;
+                    x.id = n;
+                    for (int c : parseList(cpus)) if (c < CPU_SETSIZE && CPU_ISSET(c, &all)) x.cpus.push_back(c);
+                    if (!x.cpus.empty()) nodelist.push_back(x);
+                }
+            }
+            if (nodelist.empty()) {
+                node x;
+                x.cpus = allowed;
+                nodelist.push_back(x);
+            }
+            local = numa && nodelist[0].id >= 0;
+            count = threads != 0 ? threads : available();
+        }
+
+        ~executor() {
+            {
+                std::lock_guard<std::mutex> lk(mtx);
+                stop = true;
+            }
+            cv.notify_all();
+            for (auto& th : pool) th.join();
+        }
+
+        executor(const executor&) = delete;
+        executor& operator=(const executor&) = delete;
+
+        // CPUs this process may use: its affinity mask, bounded by the cgroup quota
+        static unsigned available() {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            unsigned n = sched_getaffinity(0, sizeof(set), &set) == 0 ? static_cast<unsigned>(CPU_COUNT(&set))
+                                                                      : std::thread::hardware_concurrency();
+            n = std::max(1u, n);
+            unsigned q = quota();
+            return q != 0 ? std::min(n, q) : n;
+        }
+
+        // workers of a job on node `n` (all of them unless jobs are kept on nodes)
+        unsigned threads(size_t n = 0) const {
+            if (!local) return count;
+            return std::max(1u, std::min<unsigned>(count, static_cast<unsigned>(nodelist[n % nodelist.size()].cpus.size())));
+        }
+
+        // NUMA nodes jobs are spread over (1 unless numa), and the system id of
+        // one of them (-1 when jobs are not kept on nodes)
+        size_t nodes() const { return nodelist.size(); }
+        int nodeId(size_t n) const { return local ? nodelist[n % nodelist.size()].id : -1; }
+
+        // tasks of one job, waited for together
+        class group {
+        public:
+            // node -1: anywhere, else the tasks run on the CPUs of nodes()[node]
+            group(executor& ex, long node = -1) : ex(ex), node(node) {}
+            ~group() { wait(); }
+            group(const group&) = delete;
+            group& operator=(const group&) = delete;
+
+            // run f on the pool; with affinity, slot >= 0 pins it to one CPU
+            template <typename F> void start(F f, long slot = -1) {
+                {
+                    std::lock_guard<std::mutex> lk(mtx);
+                    pending++;
+                }
+                ex.submit(task{[this, f]() {
+                    f();
+                    std::lock_guard<std::mutex> lk(mtx);
+                    if (--pending == 0) done.notify_all();
+                }, ex.place(node, slot)});
+            }
+
+            void wait() {
+                std::unique_lock<std::mutex> lk(mtx);
+                done.wait(lk, [this]() { return pending == 0; });
+            }
+
+        private:
+            executor& ex;
+            long node;
+            std::mutex mtx;
+            std::condition_variable done;
+            size_t pending = 0;
+        };
+
+    private:
+
+        typedef struct {
+            std::function<void()> run;
+            long cpu; // -2: process mask, -1 - n: whole node n, else one cpu
+        } task;
+
+        typedef struct {
+            int id = -1;
+            std::vector<int> cpus;
+        } node;
+
+        // cpu key of a task
+        long place(long n, long slot) const {
+            size_t i = n < 0 ? 0 : static_cast<size_t>(n) % nodelist.size();
+            if (pin && slot >= 0) return nodelist[i].cpus[static_cast<size_t>(slot) % nodelist[i].cpus.size()];
+            if (local && n >= 0) return -1 - static_cast<long>(i);
+            return -2;
+        }
+
+        void bind(long key) {
+            cpu_set_t set;
+            if (key == -2) set = all;
+            else {
+                CPU_ZERO(&set);
+                if (key >= 0) CPU_SET(static_cast<int>(key), &set);
+                else for (int c : nodelist[static_cast<size_t>(-1 - key)].cpus) CPU_SET(c, &set);
+            }
+            sched_setaffinity(0, sizeof(set), &set); // best effort
+        }
+
+        void submit(task t) {
+            std::lock_guard<std::mutex> lk(mtx);
+            queue.push_back(std::move(t));
+            if (idle < queue.size()) pool.emplace_back(&executor::loop, this);
+            else cv.notify_one();
+        }
+
+        void loop() {
+            long bound = -2;
+            std::unique_lock<std::mutex> lk(mtx);
+            for (;;) {
+                idle++;
+                cv.wait(lk, [this]() { return stop || !queue.empty(); });
+                idle--;
+                if (queue.empty()) return; // stopped
+                task t = std::move(queue.front());
+                queue.pop_front();
+                lk.unlock();
+                if (t.cpu != bound) {
+                    bind(t.cpu);
+                    bound = t.cpu;
+                }
+                t.run();
+                lk.lock();
+            }
+        }
+
+        // "0-3,8,10-11"
+        static std::vector<int> parseList(const std::string& s) {
+            std::vector<int> out;
+            std::stringstream ss(s);
+            std::string item;
+            while (std::getline(ss, item, ',')) {
+                int a = 0, b = 0;
+                size_t dash = item.find('-');
+                try {
+                    a = std::stoi(item.substr(0, dash));
+                    b = dash == std::string::npos ? a : std::stoi(item.substr(dash + 1));
+                } catch (...) {
+                    continue;
+                }
+                for (int c = a; c <= b; c++) out.push_back(c);
+            }
+            return out;
+        }
+
+        // CPUs of the cgroup quota (rounded up), 0 when unlimited
+        //  cgroup v2 cpu.max of the cgroup and its parents, else v1 cfs_quota_us
+        static unsigned quota() {
+            unsigned best = 0;
+            auto limit = [&best](long long q, long long period) {
+                if (q <= 0 || period <= 0) return;
+                unsigned n = static_cast<unsigned>(std::max(1LL, (q + period - 1) / period));
+                best = best == 0 ? n : std::min(best, n);
+            };
+            std::ifstream cg("/proc/self/cgroup");
+            std::string line, path = "/";
+            while (std::getline(cg, line)) {
+                if (line.compare(0, 3, "0::") == 0) path = line.substr(3);
+            }
+            for (;;) {
+                std::ifstream f("/sys/fs/cgroup" + (path == "/" ? std::string() : path) + "/cpu.max");
+                std::string q;
+                long long period = 0;
+                if (f >> q >> period && q != "max") {
+                    try { limit(std::stoll(q), period); } catch (...) {}
+                }
+                if (path == "/" || path.empty()) break;
+                path = path.substr(0, path.find_last_of('/'));
+                if (path.empty()) path = "/";
+            }
+            std::ifstream q1("/sys/fs/cgroup/cpu/cpu.cfs_quota_us"), p1("/sys/fs/cgroup/cpu/cpu.cfs_period_us");
+            long long q = 0, p = 0;
+            if (q1 >> q && p1 >> p) limit(q, p);
+            return best;
+        }
+
+        bool pin;
+        bool local = false; // jobs are kept on nodes
+        unsigned count = 1;
+        cpu_set_t all;
+        std::vector<node> nodelist;
+        std::mutex mtx;
+        std::condition_variable cv;
+        std::deque<task> queue;
+        std::vector<std::thread> pool;
+        size_t idle = 0;
+        bool stop = false;
+
+    };
+
+} // ns::dscat
+
+#endif //DSCAT_LIB_EXECUTOR_HPP
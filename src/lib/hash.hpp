@@ -152,6 +152,75 @@ namespace dscat {
         return success;
     }
 
+    // incremental sha256
+    class hasher {
+
+    public:
+
+        hasher() {
+#ifdef OPENSSL_COMPATIBLE_11
+            context = EVP_MD_CTX_new();
+#elif OPENSSL_COMPATIBLE_10
+            context = EVP_MD_CTX_create();
+#else
+#error must be defined OPENSSL_COMPATIBLE_10 or OPENSSL_COMPATIBLE_11.
+#endif
+            good = context != NULL && EVP_DigestInit_ex(context, EVP_sha256(), NULL);
+        }
+
+        ~hasher() {
+            if (context == NULL) return;
+#ifdef OPENSSL_COMPATIBLE_11
+            EVP_MD_CTX_free(context);
+#elif OPENSSL_COMPATIBLE_10
+            EVP_MD_CTX_destroy(context);
+#else
+#error must be defined OPENSSL_COMPATIBLE_10 or OPENSSL_COMPATIBLE_11.
+#endif
+        }
+
+        hasher(const hasher&) = delete;
+        hasher& operator=(const hasher&) = delete;
+
+        bool update(const void* data, size_t len) {
+            if (good && len != 0) good = EVP_DigestUpdate(context, data, len);
+            return good;
+        }
+
+        bool final(std::string& vhash) {
+            unsigned char hash[EVP_MAX_MD_SIZE];
+            unsigned int lengthOfHash = 0;
+            if (!good || !EVP_DigestFinal_ex(context, hash, &lengthOfHash)) {
+                good = false;
+                return false;
+            }
+            std::stringstream ss;
+            for (unsigned int i = 0; i < lengthOfHash; ++i) {
+                ss << std::hex << std::setw(2) << std::setfill('0') << (int) hash[i];
+            }
+            vhash = ss.str();
+            good = false; // finalized
+            return true;
+        }
+
+        // raw digest (32 bytes), then start over for the next message
+        bool digest(unsigned char* out) {
+            unsigned int lengthOfHash = 0;
+            if (!good || !EVP_DigestFinal_ex(context, out, &lengthOfHash)) {
+                good = false;
+                return false;
+            }
+            good = EVP_DigestInit_ex(context, EVP_sha256(), NULL);
+            return lengthOfHash == 32;
+        }
+
+    private:
+
+        EVP_MD_CTX* context = NULL;
+        bool good = false;
+
+    };
+
 } // ns::dscat
 
 #endif //DSCAT_HASH_HPP
@@ -0,0 +1,544 @@
+/*
+ * Copyright (c) 2018 https://github.com/dscat/cuitool
+ *
+ * Licensed under the MIT License: http://www.opensource.org/licenses/mit-license.php
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef DSCAT_LIB_INCREMENTAL_HPP
+#define DSCAT_LIB_INCREMENTAL_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "erasure.hpp"
+#include "hash.hpp"
+#include "ioengine.hpp"
+#include "pipeline.hpp"
+#include "scatlib.hpp"
+#include "stats.hpp"
+
+namespace dscat {
+
+    // content-defined chunking with a gear rolling hash (FastCDC style: a
+    // stricter mask before the average size, a looser one after it)
+    class chunker {
+
+    public:
+
+        static constexpr size_t minsize = 16 * 1024;
+        static constexpr size_t avgsize = 64 * 1024;
+        static constexpr size_t maxsize = 256 * 1024;
+        static constexpr size_t bufsize = 4 * maxsize; // input buffer of split()
+
+        // length of the chunk starting at p (n bytes available, eof when no
+        // more follow), 0 when more bytes are needed to decide
+        static size_t cut(const char* p, size_t n, bool eof) {
+            const uint64_t strict = ((1ull << 18) - 1) << 46;
+            const uint64_t loose = ((1ull << 14) - 1) << 50;
+            const uint64_t* g = gear();
+            size_t lim = std::min(n, maxsize);
+            if (lim <= minsize) return eof ? lim : 0;
+            uint64_t h = 0;
+            size_t i = minsize, mid = std::min(lim, avgsize);
+            for (; i < mid; i++) {
+                h = (h << 1) + g[static_cast<uint8_t>(p[i])];
+                if ((h & strict) == 0) return i + 1;
+            }
+            for (; i < lim; i++) {
+                h = (h << 1) + g[static_cast<uint8_t>(p[i])];
+                if ((h & loose) == 0) return i + 1;
+            }
+            return lim == maxsize || eof ? lim : 0;
+        }
+
+        // read infd (< 0 is an empty input) and call f(p, len) for every chunk
+        //  returns 0, -4 read error, or the first non-zero result of f
+        template <typename F> static int split(int infd, stats::meter& mr, F f) {
+            iobuf buf(bufsize);
+            size_t pos = 0, end = 0;
+            bool eof = infd < 0;
+            for (;;) {
+                // keep at least maxsize bytes ahead of pos unless the input ended
+                if (!eof && end - pos < maxsize) {
+                    std::memmove(buf.data(), buf.data() + pos, end - pos);
+                    end -= pos;
+                    pos = 0;
+                    mr.begin();
+                    size_t got = 0;
+                    while (!eof && end < buf.size()) {
+                        ssize_t n = ::read(infd, buf.data() + end, buf.size() - end);
+                        if (n < 0 && errno == EINTR) continue;
+                        if (n < 0) return -4;
+                        if (n == 0) eof = true;
+                        end += static_cast<size_t>(n);
+                        got += static_cast<size_t>(n);
+                    }
+                    mr.end(got);
+                }
+                if (pos == end) return 0;
+                size_t len = cut(buf.data() + pos, end - pos, eof);
+                int r = f(buf.data() + pos, len);
+                if (r != 0) return r;
+                pos += len;
+            }
+        }
+
+    private:
+
+        static const uint64_t* gear() {
+            static const std::vector<uint64_t> t = []() {
+                std::vector<uint64_t> t(256);
+                uint64_t x = 0x6473636174636463ull; // splitmix64
+                for (auto& v : t) {
+                    uint64_t z = (x += 0x9e3779b97f4a7c15ull);
+                    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+                    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+                    v = z ^ (z >> 31);
+                }
+                return t;
+            }();
+            return t.data();
+        }
+
+    };
+
+    // chunk index kept next to each piece (<piece>.idx)
+    //  The chunks of the file in order, each pointing to its segment in the
+    //  pieces. Segments are only ever appended, so the pieces stay valid for
+    //  the previous index until the new one replaces it.
+    //  An index tells no more than its piece: the digests are of the segment
+    //  bytes of that piece, and the size and hash of the file are a stream
+    //  trailer scattered over the indexes like the data (a share in each).
+    class chunkindex {
+
+    public:
+
+        typedef struct {
+            char s = 'D';
+            char i = 'S';
+            char g = 'C';
+            char n = 'I';
+            uint32_t version = 2;
+            uint32_t count = 0;     // data pieces
+            uint32_t parity = 0;    // parity pieces
+            uint64_t filesize = 0;
+            uint64_t piecesize = 0; // piece bytes in use
+            uint64_t entries = 0;
+            char share[64] = {0};   // piece bytes of the scattered block_tail
+        } header;
+
+        typedef struct {
+            unsigned char digest[32]; // sha256 of the segment bytes of the piece
+            uint64_t poff;            // segment offset in the pieces
+            uint32_t len;             // chunk bytes
+            uint32_t plen;            // segment bytes per piece
+        } entry;
+
+        header head;
+        std::vector<entry> list;
+
+        // returns 0, -1 missing or invalid
+        int load(const std::string& path) {
+            int fd = open(path.c_str(), O_RDONLY);
+            if (fd < 0) return -1;
+            struct stat sb;
+            int ret = -1;
+            if (fstat(fd, &sb) == 0 && readAll(fd, &head, sizeof(head)) == 0
+                && head.s == 'D' && head.i == 'S' && head.g == 'C' && head.n == 'I' && head.version == 2
+                && static_cast<uint64_t>(sb.st_size) == sizeof(head) + head.entries * sizeof(entry)) {
+                list.resize(head.entries);
+                ret = readAll(fd, list.data(), list.size() * sizeof(entry));
+            }
+            close(fd);
+            return ret;
+        }
+
+        // write a temporary file and rename it over the index
+        int save(const std::string& path) {
+            return stage(path) == 0 && commit(path) == 0 ? 0 : -1;
+        }
+
+        // write the index to <path>.tmp, on disk when it returns 0
+        int stage(const std::string& path) {
+            std::string tmp = path + ".tmp";
+            int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (fd < 0) return -1;
+            head.entries = list.size();
+            int ret = pipeline::writeAll(fd, reinterpret_cast<const char*>(&head), sizeof(head));
+            if (ret == 0) ret = pipeline::writeAll(fd, reinterpret_cast<const char*>(list.data()), list.size() * sizeof(entry));
+            if (ret == 0) ret = fsync(fd);
+            close(fd);
+            if (ret != 0) unlink(tmp.c_str());
+            return ret != 0 ? -1 : 0;
+        }
+
+        // rename a staged index over the index
+        static int commit(const std::string& path) {
+            std::string tmp = path + ".tmp";
+            if (rename(tmp.c_str(), path.c_str()) == 0) return 0;
+            unlink(tmp.c_str());
+            return -1;
+        }
+
+        // same layout as `o` (the indexes of the pieces of one scatter)
+        bool same(const chunkindex& o) const {
+            if (head.count != o.head.count || head.parity != o.head.parity || head.filesize != o.head.filesize
+                || head.piecesize != o.head.piecesize || list.size() != o.list.size()) return false;
+            for (size_t i = 0; i < list.size(); i++) {
+                if (list[i].poff != o.list[i].poff || list[i].len != o.list[i].len || list[i].plen != o.list[i].plen) return false;
+            }
+            return true;
+        }
+
+        // scatter the size and hash of the file into the shares of the
+        // indexes (data pieces then parity pieces)
+        static void split(uint64_t filesize, const std::string& hash, const std::vector<uint8_t>& ma, std::vector<chunkindex>& idx) {
+            const size_t cnt = ma.size(), n = shareSize(cnt);
+            scatlib::block_tail t;
+            t.filesize = filesize;
+            std::memcpy(t.hash, hash.data(), std::min<size_t>(hash.size(), 64));
+            std::vector<char> src(n * cnt, 0);
+            std::memcpy(src.data(), &t, sizeof(t));
+            std::vector<char*> dst(idx.size());
+            for (size_t p = 0; p < idx.size(); p++) {
+                std::memset(idx[p].head.share, 0, sizeof(idx[p].head.share));
+                dst[p] = idx[p].head.share;
+            }
+            scatlib().scatBlock(src.data(), src.size(), ma, dst.data());
+            erasure(cnt, idx.size() - cnt).encode(dst.data(), dst.data() + cnt, n);
+        }
+
+        // the segments, size and hash of a file from the indexes of its pieces
+        // (nullptr where missing), the layout most of them agree on wins and
+        // any ma.size() of those are enough
+        //  returns 0, -1 too few indexes or no trailer
+        static int join(const std::vector<const chunkindex*>& idx, const std::vector<uint8_t>& ma,
+                        std::vector<pipeline::extent>& ex, uint64_t& filesize, std::string& hash) {
+            const size_t cnt = ma.size(), n = shareSize(cnt);
+            if (idx.size() < cnt) return -1;
+            const size_t npar = idx.size() - cnt;
+            auto fits = [&](const chunkindex* x) { return x != nullptr && x->head.count == cnt && x->head.parity == npar; };
+            const chunkindex* ref = nullptr;
+            size_t votes = 0;
+            for (auto r : idx) {
+                if (!fits(r)) continue;
+                size_t v = 0;
+                for (auto x : idx) v += fits(x) && x->same(*r);
+                if (v > votes) {
+                    ref = r;
+                    votes = v;
+                }
+            }
+            std::vector<std::vector<char>> bufs(idx.size(), std::vector<char>(n, 0));
+            std::vector<char*> src(idx.size());
+            std::vector<size_t> use;
+            for (size_t p = 0; p < idx.size(); p++) {
+                src[p] = bufs[p].data();
+                if (ref == nullptr || use.size() == cnt || !fits(idx[p]) || !idx[p]->same(*ref)) continue;
+                std::memcpy(src[p], idx[p]->head.share, n);
+                use.push_back(p);
+            }
+            erasure er(cnt, npar);
+            if (use.size() < cnt || er.prepare(use) != 0) return -1;
+            er.rebuild(src.data(), n);
+            std::vector<char> out(n * cnt);
+            scatlib().gatherBlock(src.data(), n, ma, out.data());
+            scatlib::block_tail t;
+            std::memcpy(&t, out.data(), sizeof(t));
+            if (t.s != 'D' || t.i != 'S' || t.g != 'C' || t.n != '2' || t.filesize != ref->head.filesize) return -1;
+            filesize = t.filesize;
+            hash.assign(t.hash, 64);
+            ex = ref->extents();
+            return 0;
+        }
+
+        // segments to gather, in file order
+        std::vector<pipeline::extent> extents() const {
+            std::vector<pipeline::extent> ex(list.size());
+            for (size_t i = 0; i < list.size(); i++) {
+                ex[i].poff = list[i].poff;
+                ex[i].plen = list[i].plen;
+                ex[i].len = list[i].len;
+            }
+            return ex;
+        }
+
+    private:
+
+        // bytes of the trailer in each share
+        static size_t shareSize(size_t cnt) { return (sizeof(scatlib::block_tail) + cnt - 1) / cnt; }
+
+        static int readAll(int fd, void* p, size_t n) {
+            char* c = static_cast<char*>(p);
+            while (n != 0) {
+                ssize_t r = ::read(fd, c, n);
+                if (r < 0 && errno == EINTR) continue;
+                if (r <= 0) return -1;
+                c += r;
+                n -= static_cast<size_t>(r);
+            }
+            return 0;
+        }
+
+    };
+
+    // incremental scatter
+    //  The input is cut into content-defined chunks and every chunk is
+    //  scattered; one whose data piece bytes match a chunk of the index of
+    //  the previous run keeps its segment, only new chunks are appended to
+    //  the pieces. Once the pieces hold as many dead bytes as live ones they
+    //  are written anew, to <piece>.tmp files renamed over the pieces at the
+    //  end. The pieces are on disk before their indexes are renamed into
+    //  place, so a crash leaves the previous version readable.
+    class incremental {
+
+    public:
+
+        typedef struct {
+            uint64_t filesize = 0;
+            uint64_t piecesize = 0;
+            std::string hash;
+            uint64_t chunks = 0;
+            uint64_t reused = 0;    // chunks found in the index
+            uint64_t written = 0;   // piece bytes written (all pieces)
+            bool fresh = false;     // no usable index, started over
+            bool compacted = false; // started over to drop dead bytes
+        } result;
+
+        incremental(const std::vector<uint8_t>& ma, ioengine& io, size_t npar = 0, stats* st = nullptr)
+                : ma(ma), io(io), npar(npar), st(st), er(ma.size(), npar) {}
+
+        // keep the buffers within `bytes` (0 is no limit) with smaller write batches
+        void maxMemory(size_t bytes) { budget = bytes; }
+
+        // scatter infd into fds (data then parity pieces, none in test mode)
+        // using the indexes <paths[i]>.idx
+        //  returns 0, -2 hashing error, -4 I/O error, -5 memory budget too small
+        int scatter(int infd, const std::vector<int>& fds, const std::vector<std::string>& paths, result& res) {
+            const size_t cnt = ma.size(), all = cnt + npar;
+            const size_t seg = chunker::maxsize / cnt + 1; // largest segment
+            res = result();
+
+            // staged segments, written in batches at the append position
+            size_t stagecap = 1 << 20;
+            if (budget != 0) {
+                size_t fixed = memory::reserve + chunker::bufsize + seg * all;
+                if (budget < fixed) return -5;
+                stagecap = std::min(stagecap, (budget - fixed) / all);
+            }
+
+            // previous indexes: one layout in all of them, and the pieces as long as they say
+            std::vector<chunkindex> idx(all);
+            bool have = paths.size() == all;
+            for (size_t p = 0; p < all && have; p++) {
+                struct stat sb;
+                have = idx[p].load(paths[p] + ".idx") == 0 && idx[p].head.count == cnt && idx[p].head.parity == npar
+                       && idx[p].same(idx[0])
+                       && (fds.empty() || (fstat(fds[p], &sb) == 0 && static_cast<uint64_t>(sb.st_size) == idx[p].head.piecesize));
+            }
+            if (have) {
+                std::unordered_set<uint64_t> segs;
+                uint64_t live = 0;
+                for (auto& e : idx[0].list) {
+                    if (segs.insert(e.poff).second) live += e.plen;
+                }
+                uint64_t dead = idx[0].head.piecesize - live;
+                res.compacted = dead != 0 && dead >= live;
+                have = !res.compacted;
+            }
+
+            // chunks of the previous run by the digests of their data piece bytes
+            // and their length (trailing zeros of a chunk leave the pieces alike)
+            typedef struct {
+                chunkindex::entry e;
+                std::string digests; // of every piece
+            } stored;
+            std::unordered_map<std::string, stored> known;
+            if (have) {
+                for (size_t i = 0; i < idx[0].list.size(); i++) {
+                    stored k;
+                    k.e = idx[0].list[i];
+                    for (size_t p = 0; p < all; p++) k.digests.append(reinterpret_cast<const char*>(idx[p].list[i].digest), 32);
+                    known[k.digests.substr(0, 32 * cnt).append(reinterpret_cast<const char*>(&k.e.len), sizeof(k.e.len))] = k;
+                }
+            }
+
+            // pieces written anew go to temporary files, dropped on failure
+            struct temps {
+                std::vector<int> fds;
+                std::vector<std::string> names;
+                ~temps() {
+                    for (auto fd : fds) close(fd);
+                    for (auto& n : names) unlink(n.c_str());
+                }
+            } tmp;
+            if (!have) {
+                for (size_t p = 0; p < fds.size(); p++) {
+                    tmp.names.push_back(paths[p] + ".tmp");
+                    int fd = open(tmp.names.back().c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+                    if (fd < 0) return -4;
+                    tmp.fds.push_back(fd);
+                }
+            }
+            const std::vector<int>& out = have ? fds : tmp.fds;
+            res.fresh = !have;
+            uint64_t append = have ? idx[0].head.piecesize : 0;
+            idx.assign(all, chunkindex());
+
+            std::vector<iobuf> stage(all, iobuf(stagecap + seg));
+            std::vector<char*> dst(all);
+            size_t fill = 0;
+            uint64_t base = append;
+            stats::meter mr, mh, mk, mw;
+            auto flush = [&]() {
+                if (fill == 0 || fds.empty()) return 0;
+                std::vector<ioengine::request> reqs;
+                for (size_t p = 0; p < out.size(); p++) reqs.push_back(ioengine::request{out[p], stage[p].data(), fill, base, true});
+                mw.begin();
+                int r = io.run(reqs);
+                mw.end(fill * fds.size());
+                base += fill;
+                fill = 0;
+                return r;
+            };
+
+            // an entry in every index, with the digest of that piece
+            auto add = [&](chunkindex::entry e, const std::string& digests) {
+                for (size_t p = 0; p < all; p++) {
+                    std::memcpy(e.digest, digests.data() + 32 * p, 32);
+                    idx[p].list.push_back(e);
+                }
+            };
+
+            hasher file, piece;
+            std::string digests(32 * all, '\0');
+            int ret = chunker::split(infd, mr, [&](const char* src, size_t len) {
+                const size_t plen = (len + cnt - 1) / cnt;
+                auto hashPieces = [&](size_t from, size_t to) {
+                    bool ok = true;
+                    mh.begin();
+                    for (size_t p = from; p < to && ok; p++) {
+                        ok = piece.update(dst[p], plen) && piece.digest(reinterpret_cast<unsigned char*>(&digests[32 * p]));
+                    }
+                    mh.end(plen * (to - from));
+                    return ok;
+                };
+                mh.begin();
+                bool ok = file.update(src, len);
+                mh.end(len);
+                if (!ok) return -2;
+
+                // scatter into the stage, the data piece bytes tell a known chunk
+                if (fill + plen > stagecap && flush() != 0) return -4;
+                for (size_t p = 0; p < all; p++) dst[p] = stage[p].data() + fill;
+                mk.begin();
+                lib.scatBlock(src, len, ma, dst.data());
+                mk.end(len);
+                if (!hashPieces(0, cnt)) return -2;
+                res.chunks++;
+                const uint32_t clen = static_cast<uint32_t>(len);
+                std::string key = digests.substr(0, 32 * cnt).append(reinterpret_cast<const char*>(&clen), sizeof(clen));
+                auto it = known.find(key);
+                if (it != known.end()) {
+                    add(it->second.e, it->second.digests);
+                    res.reused++;
+                    return 0;
+                }
+
+                // new chunk: parity, then keep it in the stage
+                if (npar != 0) {
+                    mk.begin();
+                    er.encode(dst.data(), dst.data() + cnt, plen);
+                    mk.end(0);
+                    if (!hashPieces(cnt, all)) return -2;
+                }
+                chunkindex::entry e = {};
+                e.len = clen;
+                e.plen = static_cast<uint32_t>(plen);
+                e.poff = base + fill;
+                fill += plen;
+                append += plen;
+                res.written += plen * fds.size();
+                known[key] = stored{e, digests};
+                add(e, digests);
+                return 0;
+            });
+            if (ret != 0) return ret;
+            if (flush() != 0) return -4;
+            if (!file.final(res.hash)) return -2;
+
+            // the new indexes, once the segments they point to are written
+            res.piecesize = append;
+            for (auto& e : idx[0].list) res.filesize += e.len;
+            for (auto& x : idx) {
+                x.head.count = static_cast<uint32_t>(cnt);
+                x.head.parity = static_cast<uint32_t>(npar);
+                x.head.piecesize = append;
+                x.head.filesize = res.filesize;
+            }
+            chunkindex::split(res.filesize, res.hash, ma, idx);
+            if (!fds.empty()) {
+                for (auto fd : out) {
+                    if (fdatasync(fd) != 0) return -4;
+                }
+                for (size_t p = 0; p < all; p++) {
+                    if (idx[p].stage(paths[p] + ".idx") != 0) return -4;
+                }
+                for (size_t p = 0; p < tmp.names.size(); p++) {
+                    if (rename(tmp.names[p].c_str(), paths[p].c_str()) != 0) return -4;
+                }
+                tmp.names.clear();
+                for (size_t p = 0; p < all; p++) {
+                    if (chunkindex::commit(paths[p] + ".idx") != 0) return -4;
+                }
+            }
+            if (st != nullptr) {
+                st->add("read", mr);
+                st->add("hash", mh);
+                st->add("kernel", mk);
+                st->add("write", mw);
+            }
+            return 0;
+        }
+
+    private:
+
+        std::vector<uint8_t> ma;
+        ioengine& io;
+        size_t npar;
+        stats* st;
+        erasure er;
+        scatlib lib;
+        size_t budget = 0;
+
+    };
+
+} // ns::dscat
+
+#endif //DSCAT_LIB_INCREMENTAL_HPP
@@ -0,0 +1,374 @@
+/*
+ * Copyright (c) 2018 https://github.com/dscat/cuitool
+ *
+ * Licensed under the MIT License: http://www.opensource.org/licenses/mit-license.php
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef DSCAT_LIB_IOENGINE_HPP
+#define DSCAT_LIB_IOENGINE_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define DSCAT_HAVE_IO_URING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+#include "executor.hpp"
+#include "stats.hpp"
+
+namespace dscat {
+
+    // allocator for buffers that can be used with direct I/O
+    template <typename T, size_t A = 4096> struct aligned_allocator {
+        typedef T value_type;
+        template <typename U> struct rebind { typedef aligned_allocator<U, A> other; };
+        aligned_allocator() = default;
+        template <typename U> aligned_allocator(const aligned_allocator<U, A>&) {}
+        T* allocate(size_t n) {
+            void* p = nullptr;
+            if (posix_memalign(&p, A, std::max<size_t>(n * sizeof(T), 1)) != 0) throw std::bad_alloc();
+            memory::acquire(n * sizeof(T));
+            return static_cast<T*>(p);
+        }
+        void deallocate(T* p, size_t n) {
+            memory::release(n * sizeof(T));
+            free(p);
+        }
+        bool operator==(const aligned_allocator&) const { return true; }
+        bool operator!=(const aligned_allocator&) const { return false; }
+    };
+    typedef std::vector<char, aligned_allocator<char>> iobuf;
+
+    // ioengine
+    //  Runs a batch of positional reads/writes with all of them in flight
+    //  together, so pieces on different devices are serviced in parallel.
+    //  io_uring is used when the kernel offers it (with registered buffers
+    //  when they can be pinned), otherwise a pread/pwrite thread pool.
+    class ioengine {
+
+    public:
+
+        enum backend { AUTO = 0, URING, THREADS };
+
+        typedef struct {
+            int fd;
+            char* buf;
+            size_t len;
+            uint64_t off;
+            bool write;
+        } request;
+
+        static constexpr size_t chunk = 1 << 20; // split requests into 1 MiB operations
+        static constexpr unsigned depth = 64;
+        static constexpr size_t align = 4096; // offsets, lengths and addresses for direct I/O
+
+        // bypass the page cache on fd (O_DIRECT, or F_NOCACHE on macOS)
+        static int direct(int fd, bool on) {
+#if defined(O_DIRECT)
+            int fl = fcntl(fd, F_GETFL);
+            if (fl < 0) return -1;
+            return fcntl(fd, F_SETFL, on ? (fl | O_DIRECT) : (fl & ~O_DIRECT));
+#elif defined(F_NOCACHE)
+            return fcntl(fd, F_NOCACHE, on ? 1 : 0);
+#else
+            return -1;
+#endif
+        }
+
+        // whether direct I/O on this platform needs aligned transfers
+        static bool alignedDirect() {
+#if defined(O_DIRECT)
+            return true;
+#else
+            return false;
+#endif
+        }
+
+        explicit ioengine(backend b = AUTO) {
+#ifdef DSCAT_HAVE_IO_URING
+            if (b != THREADS && ring.setup(depth) == 0) {
+                kind = URING;
+                return;
+            }
+#endif
+            kind = THREADS;
+        }
+
+        const char* name() const { return kind == URING ? "io_uring" : "threads"; }
+        backend type() const { return kind; }
+
+        // run the transfers of the threads backend on the executor's threads
+        void use(executor& e) { ex = &e; }
+
+        // pin buffers for the whole job (io_uring fixed buffers, best effort)
+        void pin(const std::vector<std::pair<char*, size_t>>& bufs) {
+#ifdef DSCAT_HAVE_IO_URING
+            if (kind == URING) ring.pin(bufs);
+#endif
+        }
+
+        // execute all requests, returns 0 or -errno of the first failure
+        int run(const std::vector<request>& reqs) {
+            thread_local std::vector<request> ops; // kept, so that a job allocates only on its first runs
+            ops.clear();
+            for (auto& r : reqs) {
+                for (size_t done = 0; done < r.len; done += chunk) {
+                    request op = r;
+                    op.buf = r.buf + done;
+                    op.off = r.off + done;
+                    op.len = std::min(chunk, r.len - done);
+                    ops.push_back(op);
+                }
+            }
+#ifdef DSCAT_HAVE_IO_URING
+            if (kind == URING) return ring.run(ops);
+#endif
+            return runThreads(ops);
+        }
+
+    private:
+
+        backend kind;
+        executor* ex = nullptr;
+
+        // one positional transfer, looping over short reads/writes
+        static int transfer(const request& r) {
+            size_t done = 0;
+            while (done < r.len) {
+                ssize_t n = r.write ? ::pwrite(r.fd, r.buf + done, r.len - done, r.off + done)
+                                    : ::pread(r.fd, r.buf + done, r.len - done, r.off + done);
+                if (n < 0 && errno == EINTR) continue;
+                if (n < 0) return -errno;
+                if (n == 0) return -EIO; // unexpected end of file
+                done += static_cast<size_t>(n);
+            }
+            return 0;
+        }
+
+        int runThreads(const std::vector<request>& ops) {
+            std::atomic<size_t> next{0};
+            std::atomic<int> err{0};
+            size_t n = std::min<size_t>(ops.size(), depth);
+            auto work = [&]() {
+                for (size_t i; (i = next++) < ops.size() && err == 0; ) {
+                    int ret = transfer(ops[i]);
+                    if (ret != 0) err = ret;
+                }
+            };
+            if (ex != nullptr) {
+                executor::group g(*ex);
+                for (size_t i = 1; i < n; i++) g.start(work);
+                work();
+                g.wait();
+                return err;
+            }
+            std::vector<std::thread> ths;
+            for (size_t i = 1; i < n; i++) ths.emplace_back(work);
+            work();
+            for (auto& th : ths) th.join();
+            return err;
+        }
+
+#ifdef DSCAT_HAVE_IO_URING
+        // minimal io_uring over the raw syscalls (no liburing dependency)
+        class uring {
+        public:
+            ~uring() {
+                if (fd < 0) return;
+                if (pinned) syscall(__NR_io_uring_register, fd, IORING_UNREGISTER_BUFFERS, nullptr, 0);
+                if (sqes != nullptr) munmap(sqes, nsqes * sizeof(io_uring_sqe));
+                if (cqptr != nullptr && cqptr != sqptr) munmap(cqptr, cqsz);
+                if (sqptr != nullptr) munmap(sqptr, sqsz);
+                ::close(fd);
+            }
+
+            int setup(unsigned entries) {
+                io_uring_params p;
+                std::memset(&p, 0, sizeof(p));
+                fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &p));
+                if (fd < 0) return -1;
+                sqsz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+                cqsz = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+                if (p.features & IORING_FEAT_SINGLE_MMAP) sqsz = cqsz = std::max(sqsz, cqsz);
+                sqptr = mmap(nullptr, sqsz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+                if (sqptr == MAP_FAILED) { sqptr = nullptr; return -1; }
+                if (p.features & IORING_FEAT_SINGLE_MMAP) cqptr = sqptr;
+                else {
+                    cqptr = mmap(nullptr, cqsz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+                    if (cqptr == MAP_FAILED) { cqptr = nullptr; return -1; }
+                }
+                nsqes = p.sq_entries;
+                void* s = mmap(nullptr, nsqes * sizeof(io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+                if (s == MAP_FAILED) return -1;
+                sqes = static_cast<io_uring_sqe*>(s);
+                char* sq = static_cast<char*>(sqptr);
+                char* cq = static_cast<char*>(cqptr);
+                sqhead = reinterpret_cast<std::atomic<unsigned>*>(sq + p.sq_off.head);
+                sqtail = reinterpret_cast<std::atomic<unsigned>*>(sq + p.sq_off.tail);
+                sqmask = *reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+                sqarray = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+                cqhead = reinterpret_cast<std::atomic<unsigned>*>(cq + p.cq_off.head);
+                cqtail = reinterpret_cast<std::atomic<unsigned>*>(cq + p.cq_off.tail);
+                cqmask = *reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+                cqes = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+                return 0;
+            }
+
+            void pin(const std::vector<std::pair<char*, size_t>>& bufs) {
+                if (pinned) {
+                    syscall(__NR_io_uring_register, fd, IORING_UNREGISTER_BUFFERS, nullptr, 0);
+                    pinned = false;
+                }
+                regions.clear();
+                std::vector<iovec> iov;
+                for (auto& b : bufs) {
+                    if (b.second == 0) continue;
+                    iov.push_back(iovec{b.first, b.second});
+                }
+                if (iov.empty()) return;
+                // fails e.g. over RLIMIT_MEMLOCK; plain read/write is used then
+                if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_BUFFERS, iov.data(), iov.size()) != 0) return;
+                regions = iov;
+                pinned = true;
+            }
+
+            int run(const std::vector<request>& ops) {
+                todo.assign(ops.begin(), ops.end()); // progress of short transfers is kept here
+                retry.clear();
+                size_t next = 0, inflight = 0, finished = 0;
+                int err = 0;
+                while (finished < todo.size()) {
+                    // submit
+                    unsigned tail = sqtail->load(std::memory_order_relaxed);
+                    while (inflight < nsqes && err == 0 && (!retry.empty() || next < todo.size())) {
+                        size_t i;
+                        if (!retry.empty()) { i = retry.back(); retry.pop_back(); }
+                        else i = next++;
+                        prepare(sqes[tail & sqmask], todo[i], i);
+                        sqarray[tail & sqmask] = tail & sqmask;
+                        tail++;
+                        inflight++;
+                    }
+                    sqtail->store(tail, std::memory_order_release);
+                    if (inflight == 0) break; // stopped by an error
+                    unsigned tosubmit = tail - sqhead->load(std::memory_order_acquire);
+                    int r = static_cast<int>(syscall(__NR_io_uring_enter, fd, tosubmit, 1, IORING_ENTER_GETEVENTS, nullptr, 0));
+                    if (r < 0 && errno != EINTR) {
+                        // stop: take back the entries the kernel has not
+                        // consumed, the ones it has are reaped before the
+                        // caller gets its buffers back
+                        const int e = errno;
+                        if (err == 0) err = -e;
+                        unsigned head = sqhead->load(std::memory_order_acquire);
+                        inflight -= tail - head;
+                        sqtail->store(head, std::memory_order_release);
+                        if (tosubmit == 0 && e != EAGAIN && e != EBUSY) return err; // cannot wait for them either
+                    }
+
+                    // reap
+                    unsigned head = cqhead->load(std::memory_order_relaxed);
+                    while (head != cqtail->load(std::memory_order_acquire)) {
+                        io_uring_cqe& cqe = cqes[head & cqmask];
+                        size_t i = static_cast<size_t>(cqe.user_data);
+                        int res = cqe.res;
+                        head++;
+                        inflight--;
+                        request& op = todo[i];
+                        if (res == -EINTR || res == -EAGAIN) retry.push_back(i);
+                        else if (res < 0) { if (err == 0) err = res; finished++; }
+                        else if (res == 0) { if (err == 0) err = -EIO; finished++; }
+                        else if (static_cast<size_t>(res) < op.len) {
+                            op.buf += res;
+                            op.off += res;
+                            op.len -= res;
+                            retry.push_back(i);
+                        }
+                        else finished++;
+                    }
+                    cqhead->store(head, std::memory_order_release);
+                    if (err != 0 && inflight == 0) break;
+                }
+                return err;
+            }
+
+        private:
+
+            void prepare(io_uring_sqe& sqe, const request& op, size_t idx) {
+                std::memset(&sqe, 0, sizeof(sqe));
+                int bi = -1;
+                for (size_t k = 0; k < regions.size(); k++) {
+                    char* base = static_cast<char*>(regions[k].iov_base);
+                    if (op.buf >= base && op.buf + op.len <= base + regions[k].iov_len) { bi = static_cast<int>(k); break; }
+                }
+                if (bi >= 0) {
+                    sqe.opcode = op.write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+                    sqe.buf_index = static_cast<uint16_t>(bi);
+                } else {
+                    sqe.opcode = op.write ? IORING_OP_WRITE : IORING_OP_READ;
+                }
+                sqe.fd = op.fd;
+                sqe.off = op.off;
+                sqe.addr = reinterpret_cast<uint64_t>(op.buf);
+                sqe.len = static_cast<uint32_t>(op.len);
+                sqe.user_data = idx;
+            }
+
+            int fd = -1;
+            void* sqptr = nullptr;
+            void* cqptr = nullptr;
+            size_t sqsz = 0, cqsz = 0;
+            io_uring_sqe* sqes = nullptr;
+            unsigned nsqes = 0;
+            std::atomic<unsigned>* sqhead = nullptr;
+            std::atomic<unsigned>* sqtail = nullptr;
+            unsigned sqmask = 0;
+            unsigned* sqarray = nullptr;
+            std::atomic<unsigned>* cqhead = nullptr;
+            std::atomic<unsigned>* cqtail = nullptr;
+            unsigned cqmask = 0;
+            io_uring_cqe* cqes = nullptr;
+            std::vector<iovec> regions;
+            bool pinned = false;
+            std::vector<request> todo; // scratch of run(), reused
+            std::vector<size_t> retry;
+        };
+        uring ring;
+#endif
+
+    };
+
+} // ns::dscat
+
+#endif //DSCAT_LIB_IOENGINE_HPP
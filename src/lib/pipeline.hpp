@@ -0,0 +1,1464 @@
+/*
+ * Copyright (c) 2018 https://github.com/dscat/cuitool
+ *
+ * Licensed under the MIT License: http://www.opensource.org/licenses/mit-license.php
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef DSCAT_LIB_PIPELINE_HPP
+#define DSCAT_LIB_PIPELINE_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <random>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "arena.hpp"
+#include "compress.hpp"
+#include "erasure.hpp"
+#include "executor.hpp"
+#include "hash.hpp"
+#include "ioengine.hpp"
+#include "scatlib.hpp"
+#include "stats.hpp"
+
+namespace dscat {
+
+    // bounded lock-free MPMC queue (Vyukov)
+    template <typename T> class ring {
+
+    public:
+
+        explicit ring(size_t capacity) {
+            size_t n = 2;
+            while (n < capacity) n <<= 1;
+            cells.reset(new cell[n]);
+            for (size_t i = 0; i < n; i++) cells[i].seq.store(i, std::memory_order_relaxed);
+            mask = n - 1;
+        }
+
+        bool tryPush(const T& v) {
+            size_t pos = enq.load(std::memory_order_relaxed);
+            for (;;) {
+                cell& c = cells[pos & mask];
+                size_t seq = c.seq.load(std::memory_order_acquire);
+                intptr_t dif = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+                if (dif == 0) {
+                    if (enq.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                        c.val = v;
+                        c.seq.store(pos + 1, std::memory_order_release);
+                        return true;
+                    }
+                }
+                else if (dif < 0) return false; // full
+                else pos = enq.load(std::memory_order_relaxed);
+            }
+        }
+
+        bool tryPop(T& v) {
+            size_t pos = deq.load(std::memory_order_relaxed);
+            for (;;) {
+                cell& c = cells[pos & mask];
+                size_t seq = c.seq.load(std::memory_order_acquire);
+                intptr_t dif = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+                if (dif == 0) {
+                    if (deq.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                        v = c.val;
+                        c.seq.store(pos + mask + 1, std::memory_order_release);
+                        return true;
+                    }
+                }
+                else if (dif < 0) return false; // empty
+                else pos = deq.load(std::memory_order_relaxed);
+            }
+        }
+
+        // blocking variants, give up (false) once `abort` is raised
+        bool push(const T& v, const std::atomic<bool>& abort) {
+            for (unsigned n = 0; !tryPush(v); n++) {
+                if (abort.load(std::memory_order_relaxed)) return false;
+                backoff(n);
+            }
+            return true;
+        }
+        bool pop(T& v, const std::atomic<bool>& abort) {
+            for (unsigned n = 0; !tryPop(v); n++) {
+                if (abort.load(std::memory_order_relaxed)) return false;
+                backoff(n);
+            }
+            return true;
+        }
+
+        // pause of the n-th retry of a waiting loop
+        static void backoff(unsigned n) {
+            if (n < 64) std::this_thread::yield();
+            else std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+
+    private:
+
+        struct cell {
+            std::atomic<size_t> seq;
+            T val;
+        };
+        std::unique_ptr<cell[]> cells;
+        size_t mask = 0;
+        alignas(64) std::atomic<size_t> enq{0};
+        alignas(64) std::atomic<size_t> deq{0};
+
+    };
+
+    // pipeline
+    //  source -> kernel workers -> sink, running concurrently and linked by
+    //  rings of reusable chunks. The source and sink stay in stream order,
+    //  workers take chunks in any order and the sink puts them back in order.
+    //
+    //  scatter : stdin reader (+ data hash) -> [compress] scatBlock [parity] -> piece writer (ioengine)
+    //  gather  : piece reader (ioengine) -> [rebuild] gatherBlock -> [decompress] output writer (+ verify)
+    class pipeline {
+
+    public:
+
+        typedef struct chunk {
+            uint64_t seq = 0;
+            uint64_t soff = 0; // stream offset
+            size_t len = 0;    // stream bytes
+            size_t plen = 0;   // piece bytes
+            bool last = false;
+            const char* src = nullptr; // stream bytes to scatter (stream, or the input mapping)
+            arena::span stream;              // buffers are parts of one arena slot
+            arena::span packed;              // framed stream bytes (compression)
+            std::vector<arena::span> pieces; // data pieces, then parity pieces
+        } chunk;
+
+        typedef struct {
+            uint64_t filesize = 0;
+            uint64_t piecesize = 0;
+            std::string hash;                // sha256 of the data
+            std::vector<std::string> hashes; // sha256 of each piece (scatter, on request)
+            std::vector<size_t> rebuilt;     // data pieces rebuilt from parity (gather)
+            std::vector<size_t> broken;      // pieces that failed their digest (gather)
+            bool tagged = false;             // the pieces have tails (gather)
+            bool direct = false;             // direct I/O was in effect
+        } result;
+
+        // metadata of a piece set (inspect)
+        typedef struct {
+            enum kind { UNKNOWN = 0, STREAM, FRAMED, LEGACY };
+            kind format = UNKNOWN;           // trailer, trailer of a compressed stream, or header
+            uint32_t version = 0;            // of the piece tails, 0 without tails
+            scatlib::grain grain = scatlib::GRAIN_BIT; // interleave granularity
+            size_t width = 1;                // piece bytes per group
+            bool keyed = false;              // scattered with a key
+            uint64_t piecesize = 0;          // piece bytes (before the tail)
+            uint64_t filesize = 0;           // data bytes
+            std::string hash;                // sha256 of the data
+            std::vector<size_t> missing;     // pieces that are not there
+            std::vector<size_t> inconsistent; // pieces with a wrong tail or size
+        } info;
+
+        // piece range of one segment of an indexed (incremental) scatter
+        typedef struct {
+            uint64_t poff = 0; // piece offset
+            size_t plen = 0;   // piece bytes
+            size_t len = 0;    // data bytes
+        } extent;
+
+        static constexpr size_t piecechunk = 128 * 1024; // piece bytes per chunk (multiple of ioengine::align)
+        static constexpr size_t fuseblock = 32 * 1024;   // stream bytes scattered and hashed together (fits L1/L2)
+
+        pipeline(const std::vector<uint8_t>& ma, ioengine& io, executor& ex, stats* st = nullptr)
+                : ma(ma), io(io), ex(ex), workers(ex.threads()), active(workers), st(st) {}
+
+        // run on NUMA node `n` of the executor, with the buffers there
+        void place(size_t n) {
+            node = n;
+            workers = ex.threads(n);
+        }
+
+        // at most `w` workers (jobs sharing the executor)
+        void maxThreads(unsigned w) { workers = std::max(1u, std::min(workers, w)); }
+
+        // bypass the page cache for piece and output files
+        void directIO(bool on) { direct = on; }
+
+        // compress the stream before scattering (codec::STORED is off)
+        void compression(codec::kind k) { pack = k; }
+
+        // parity pieces following the data pieces (0 - erasure::maxparity)
+        void parity(size_t m) { npar = m; }
+
+        // back the chunk buffers with huge pages when the system has them
+        void hugePages(bool on) { huge = on; }
+
+        // interleave granularity of scatter, `w` piece bytes per group for
+        // scatlib::GRAIN_BLOCK (gather takes both from the piece tails)
+        //  returns 0, -1 not a granularity or a width (a power of 2 up to scatlib::maxwidth)
+        int interleave(scatlib::grain g, size_t w = 1) {
+            if (g != scatlib::GRAIN_BLOCK) w = 1;
+            if (g > scatlib::GRAIN_BLOCK || w == 0 || w > scatlib::maxwidth || (w & (w - 1)) != 0) return -1;
+            if (lib.makeMasks(ma, static_cast<int>(ma.size()), g) != 0) return -1;
+            if (lib.keySchedule(secret, ma.size(), g) != 0) return -1;
+            grain = g;
+            width = w;
+            return 0;
+        }
+
+        // scramble bit and nibble interleaves with a schedule drawn from `k`
+        // (empty: the round robin), keyed pieces carry a check of the key
+        //  returns 0, -1 the interleave cannot be keyed, -2 hashing error
+        int key(const std::string& k) {
+            secret = k;
+            check.clear();
+            if (!k.empty() && !scatlib::keyCheck(k, check)) return -2;
+            return interleave(grain, width);
+        }
+
+        // keep the buffers within `bytes` (0 is no limit) by choosing smaller
+        // chunks and fewer workers
+        void maxMemory(size_t bytes) { budget = bytes; }
+
+        // choices of the last scatter/gather
+        size_t chunkSize() const { return pchunk; }
+        unsigned threads() const { return active; }
+
+        // gather these segments in order instead of the stream of the pieces
+        void segments(const std::vector<extent>& s, uint64_t filesize, const std::string& hash) {
+            segs = s;
+            segmented = true;
+            segsize = filesize;
+            seghash = hash;
+        }
+
+        // scatter the input fd into the pieces (infd < 0 is an empty input, no
+        // writes when fds is empty, else data pieces then parity pieces)
+        //  returns 0, -2 hashing error, -4 I/O error, -5 memory budget too small or
+        //  no memory for the chunk pool
+        int scatter(int infd, const std::vector<int>& fds, bool hashpieces, result& res) {
+            const size_t cnt = ma.size();
+            const size_t metalen = sizeof(scatlib::block_tail);
+            const bool packing = pack != codec::STORED;
+            res = result();
+            res.hashes.assign(cnt + npar, std::string());
+            res.direct = direct && enableDirect(fds);
+            er = erasure(cnt, npar);
+            // frames are padded to whole groups, or to aligned piece bytes under direct I/O
+            const size_t group = cnt * width, stripe = striping();
+            const size_t unit = cnt * (res.direct ? ioengine::align : width);
+            auto layout = [&](size_t pc, size_t& streamcap, size_t& piececap, size_t& packcap) {
+                size_t cap = pc * cnt;
+                packcap = packing ? sizeof(scatlib::block_frame) + cap + unit + metalen + group : 0;
+                streamcap = cap + group + metalen;
+                piececap = (std::max(cap, packcap) + group + metalen) / cnt + width;
+            };
+            // a mapped input keeps up to a chunk of input resident per chunk
+            int ret = plan(ioengine::align, [&](size_t pc, unsigned w) {
+                size_t sc, pcap, kc;
+                layout(pc, sc, pcap, kc);
+                return (w * 2 + 2) * (chunkBytes(sc, pcap, kc) + pc * cnt);
+            });
+            if (ret != 0) return ret;
+            const size_t cap = pchunk * cnt;
+            size_t streamcap, piececap, packcap;
+            layout(pchunk, streamcap, piececap, packcap);
+            if (init(streamcap, piececap, 0, packcap) != 0) return -5;
+
+            // source: read, hash and append the trailer to the last chunk
+            input in(infd); // outlives the workers, which may read from its mapping
+            auto source = [&]() {
+                stats::meter mr, mh;
+                hasher h;
+                uint64_t total = 0;
+                for (uint64_t seq = 0; ; seq++) {
+                    chunk* k;
+                    if (!freed->pop(k, abort)) break;
+                    mr.begin();
+                    size_t len = 0;
+                    if (in.next(k, cap, len) != 0) {
+                        fail(-4);
+                        break;
+                    }
+                    mr.end(len);
+                    mh.begin();
+                    h.update(k->src, len);
+                    mh.end(len);
+                    k->seq = seq;
+                    k->soff = total;
+                    total += len;
+                    k->last = in.eof();
+                    if (k->last) {
+                        if (k->src != k->stream.data()) {
+                            std::memcpy(k->stream.data(), k->src, len); // room for the trailer
+                            k->src = k->stream.data();
+                        }
+                        scatlib::block_tail tail;
+                        std::string hash;
+                        if (!h.final(hash)) {
+                            fail(-2);
+                            break;
+                        }
+                        tail.filesize = total;
+                        tail.flags = packing ? scatlib::TAIL_FRAMED : 0;
+                        std::memcpy(tail.hash, hash.data(), 64);
+                        // framed streams are padded by the kernel
+                        size_t pad = packing ? 0 : (group - (total + sizeof(tail)) % group) % group;
+                        std::memset(&k->stream[len], 0, pad);
+                        std::memcpy(&k->stream[len + pad], &tail, sizeof(tail));
+                        len += pad + sizeof(tail);
+                        res.filesize = total;
+                        res.hash = hash;
+                    }
+                    k->len = len;
+                    if (!work->push(k, abort) || k->last) break;
+                }
+                for (unsigned i = 0; i < active; i++) work->push(nullptr, abort);
+                if (st != nullptr) {
+                    st->add("read", mr);
+                    st->add("hash", mh);
+                }
+            };
+
+            // piece hashers, fed in stream order by the kernels
+            std::vector<std::unique_ptr<hasher>> hs;
+            if (hashpieces || !fds.empty()) for (size_t p = 0; p < cnt + npar; p++) hs.emplace_back(new hasher());
+            std::atomic<uint64_t> turn{0}; // next chunk to hash
+
+            // kernel (compress the data of the chunk into one frame first, then
+            // scatter, encode and hash a cache-sized block at a time; the chunk
+            // next in stream order hashes its piece bytes while they are still
+            // in cache, the others hash theirs once their turn comes)
+            auto kernel = [&]() {
+                stats::meter mk, mc, me, mh;
+                std::vector<char*> dst(cnt + npar), sub(cnt + npar);
+                const size_t step = std::max(group, fuseblock / group * group);
+                chunk* k;
+                while (work->pop(k, abort) && k != nullptr) {
+                    const char* src = k->src;
+                    size_t len = k->len;
+                    if (packing) {
+                        mc.begin();
+                        size_t data = k->last ? len - metalen : len;
+                        len = frame(k->src, data, k->packed.data(), unit);
+                        if (k->last) {
+                            size_t pad = (group - metalen % group) % group;
+                            std::memset(k->packed.data() + len, 0, pad);
+                            std::memcpy(k->packed.data() + len + pad, k->src + data, metalen);
+                            len += pad + metalen;
+                        }
+                        src = k->packed.data();
+                        mc.end(data);
+                    }
+                    for (size_t p = 0; p < cnt + npar; p++) dst[p] = k->pieces[p].data();
+                    k->plen = (len + group - 1) / group * width;
+                    size_t hashed = 0; // piece bytes of the chunk hashed so far
+                    auto feed = [&](size_t upto) {
+                        mh.begin();
+                        for (size_t p = 0; p < hs.size(); p++) hs[p]->update(dst[p] + hashed, upto - hashed);
+                        mh.end((upto - hashed) * hs.size());
+                        hashed = upto;
+                    };
+                    for (size_t off = 0; off < len; off += step) {
+                        size_t n = std::min(step, len - off), poff = off / cnt, pn = (n + group - 1) / group * width;
+                        for (size_t p = 0; p < cnt + npar; p++) sub[p] = dst[p] + poff;
+                        mk.begin();
+                        lib.scatBlock(src + off, n, ma, sub.data(), stripe);
+                        mk.end(n);
+                        if (npar != 0) {
+                            me.begin();
+                            er.encode(sub.data(), sub.data() + cnt, pn);
+                            me.end(pn * npar);
+                        }
+                        if (!hs.empty() && turn.load(std::memory_order_acquire) == k->seq) feed(poff + pn);
+                    }
+                    if (!hs.empty()) {
+                        bool ready = true;
+                        for (unsigned w = 0; turn.load(std::memory_order_acquire) != k->seq; w++) {
+                            if (abort.load(std::memory_order_relaxed)) {
+                                ready = false;
+                                break;
+                            }
+                            ring<chunk*>::backoff(w);
+                        }
+                        if (!ready) break;
+                        feed(k->plen);
+                        turn.store(k->seq + 1, std::memory_order_release);
+                    }
+                    if (!done->push(k, abort)) break;
+                }
+                if (st != nullptr) {
+                    st->add("kernel", mk);
+                    if (packing) st->add("compress", mc);
+                    if (npar != 0) st->add("parity", me);
+                    if (!hs.empty()) st->add("hash", mh);
+                }
+            };
+
+            // sink: write the pieces in order, then the piece tails
+            auto sink = [&]() {
+                stats::meter mw;
+                std::vector<chunk*> ready;
+                std::vector<ioengine::request> reqs;
+                uint64_t poff = 0;
+                for (bool last = false; !last; ) {
+                    if (!nextInOrder(ready)) return;
+                    reqs.clear();
+                    uint64_t bytes = 0;
+                    for (auto k : ready) {
+                        size_t plen = k->plen;
+                        for (size_t p = 0; p < fds.size(); p++) {
+                            reqs.push_back(ioengine::request{fds[p], k->pieces[p].data(), plen, poff, true});
+                        }
+                        poff += plen;
+                        bytes += plen * fds.size();
+                        last = last || k->last;
+                    }
+                    mw.begin();
+                    int ret = transfer(reqs, res.direct);
+                    mw.end(bytes);
+                    if (ret != 0) {
+                        fail(-4);
+                        return;
+                    }
+                    for (auto k : ready) freed->push(k, abort);
+                }
+                res.piecesize = poff;
+                for (size_t p = 0; p < hs.size(); p++) {
+                    if (!hs[p]->final(res.hashes[p])) {
+                        fail(-2);
+                        return;
+                    }
+                }
+                std::vector<scatlib::piece_tail> tails(fds.size());
+                scatlib::piece_set ps;
+                std::random_device rd;
+                for (size_t i = 0; i < sizeof(ps.id); i += 4) {
+                    uint32_t v = rd();
+                    std::memcpy(ps.id + i, &v, 4);
+                }
+                if (!check.empty()) {
+                    ps.flags = scatlib::SET_KEYED;
+                    std::memcpy(ps.check, check.data(), std::min<size_t>(check.size(), 64));
+                }
+                const size_t kl = sizeof(ps);
+                reqs.clear();
+                for (size_t p = 0; p < fds.size(); p++) {
+                    tails[p].grain = grain;
+                    tails[p].width = static_cast<uint16_t>(width);
+                    reqs.push_back(ioengine::request{fds[p], reinterpret_cast<char*>(&ps), kl, poff, true});
+                    tails[p].index = static_cast<uint32_t>(p);
+                    tails[p].count = static_cast<uint32_t>(cnt);
+                    tails[p].parity = static_cast<uint32_t>(npar);
+                    tails[p].length = poff;
+                    std::memcpy(tails[p].digest, res.hashes[p].data(), 64);
+                    reqs.push_back(ioengine::request{fds[p], reinterpret_cast<char*>(&tails[p]), sizeof(tails[p]), poff + kl, true});
+                }
+                mw.begin();
+                if (transfer(reqs, res.direct) != 0) fail(-4);
+                mw.end((kl + sizeof(scatlib::piece_tail)) * fds.size());
+                if (st != nullptr) st->add("write", mw);
+            };
+
+            return run(source, kernel, sink);
+        }
+
+        // gather the pieces into `outfd` (no writes when outfd < 0), verifying the hash
+        // and, with tails, the digests of the pieces read
+        //  fds are the data pieces then the parity pieces, a missing one is -1;
+        //  any ma.size() intact pieces are enough
+        //  returns 0, -1 broken pieces, -2 hashing error, -3 hash mismatch, -4 I/O error,
+        //  -5 memory budget too small or no memory for the chunk pool, -6 the pieces
+        //  need another key (or none)
+        int gather(const std::vector<int>& fds, int outfd, result& res) {
+            // pieces that fail their digest on the way are left out of another
+            // pass, unless part of the output is gone where it cannot be taken back
+            struct stat ob;
+            bool rewind = outfd < 0 || (fstat(outfd, &ob) == 0 && S_ISREG(ob.st_mode));
+            std::vector<size_t> skip;
+            for (;;) {
+                size_t known = skip.size();
+                bool wrote = false;
+                int r = pass(fds, outfd, skip, wrote, res);
+                if (r != -1 || skip.size() == known || (wrote && !rewind)) return r;
+                if (wrote && outfd >= 0 && (ftruncate(outfd, 0) != 0 || lseek(outfd, 0, SEEK_SET) < 0)) return -4;
+            }
+        }
+
+        // the tails of the pieces, and their sizes
+        //  sizes[p] is the file size, or the piece bytes before the tail;
+        //  tagged tells whether the pieces have tails (former scatters and
+        //  incremental pieces do not), if so a piece without a valid tail of
+        //  the set is listed in broken; the digests are checked as the pieces
+        //  are gathered, or by validate()
+        //  returns 0, -4 I/O error
+        int tails(const std::vector<int>& fds, std::vector<uint64_t>& sizes, bool& tagged, std::vector<size_t>& broken) {
+            ptails.assign(fds.size(), scatlib::piece_tail());
+            std::vector<scatlib::piece_set> sets(fds.size());
+            phas.assign(fds.size(), 0);
+            sizes.assign(fds.size(), 0);
+            tagged = false;
+            broken.clear();
+            for (size_t p = 0; p < fds.size(); p++) {
+                if (fds[p] < 0) continue;
+                int r = readTail(fds[p], ptails[p], sets[p], sizes[p]);
+                if (r < 0) return -4;
+                phas[p] = r == 0 && ptails[p].index == p && ptails[p].count == ma.size() && ptails[p].parity == npar;
+                tagged = tagged || phas[p];
+            }
+            if (!tagged) return interleave(scatlib::GRAIN_BIT) == 0 ? 0 : -4;
+            if (pick(ptails, sets, phas) != 0) return -4;
+            for (size_t p = 0; p < fds.size(); p++) {
+                if (fds[p] < 0) continue;
+                if (phas[p]) sizes[p] = ptails[p].length;
+                else broken.push_back(p);
+            }
+            return 0;
+        }
+
+        // check the tagged pieces the last gather did not read against their
+        // digests, all of them in parallel on the executor; a piece that fails
+        // is added to broken
+        void validate(const std::vector<int>& fds, std::vector<size_t>& broken) {
+            std::vector<size_t> which;
+            for (size_t p = 0; p < fds.size() && p < phas.size(); p++) {
+                bool read = std::find(inuse.begin(), inuse.end(), p) != inuse.end();
+                bool known = std::find(broken.begin(), broken.end(), p) != broken.end();
+                if (fds[p] >= 0 && phas[p] && !read && !known) which.push_back(p);
+            }
+            for (auto p : digests(fds, which)) broken.push_back(p);
+            std::sort(broken.begin(), broken.end());
+        }
+
+        // the tail of a piece, the set record before it and the file size
+        //  returns 0, 1 no (well-formed) tail, -4 I/O error
+        static int readTail(int fd, scatlib::piece_tail& t, scatlib::piece_set& set, uint64_t& size) {
+            const size_t tl = sizeof(t);
+            struct stat sb;
+            if (fstat(fd, &sb) != 0) return -4;
+            size = static_cast<uint64_t>(sb.st_size);
+            set = scatlib::piece_set();
+            if (size < tl || ::pread(fd, &t, tl, static_cast<off_t>(size - tl)) != static_cast<ssize_t>(tl)) return 1;
+            bool good = t.s == 'D' && t.i == 'S' && t.g == 'C' && t.n == 'P' && t.version == 1
+                        && t.length + sizeof(set) + tl == size;
+            if (!good) return 1;
+            if (::pread(fd, &set, sizeof(set), static_cast<off_t>(t.length)) != static_cast<ssize_t>(sizeof(set))) return -4;
+            if (set.s != 'D' || set.i != 'S' || set.g != 'C' || set.n != 'S') return 1;
+            return 0;
+        }
+
+        // what a piece set holds, from the piece tails, the file sizes and the
+        // stream trailer (a few bytes of each piece, none of the bulk)
+        //  returns 0, -1 too few consistent pieces to read the metadata, -4 I/O error,
+        //  -6 the pieces need another key (or none)
+        int inspect(const std::vector<int>& fds, info& out) {
+            const size_t cnt = ma.size();
+            out = info();
+            if (fds.size() != cnt + npar) return -1;
+            std::vector<scatlib::piece_tail> tails(fds.size());
+            std::vector<scatlib::piece_set> sets(fds.size());
+            std::vector<uint64_t> sizes(fds.size(), 0);
+            std::vector<char> has(fds.size(), 0);
+            for (size_t p = 0; p < fds.size(); p++) {
+                if (fds[p] < 0) {
+                    out.missing.push_back(p);
+                    continue;
+                }
+                int r = readTail(fds[p], tails[p], sets[p], sizes[p]);
+                if (r < 0) return -4;
+                has[p] = r == 0 && tails[p].index == p && tails[p].count == cnt && tails[p].parity == npar;
+            }
+            if (pick(tails, sets, has) != 0) return -4;
+            for (size_t p = 0; p < fds.size(); p++) {
+                if (!has[p]) continue;
+                out.version = tails[p].version;
+                sizes[p] = tails[p].length;
+            }
+            out.grain = grain;
+            out.width = width;
+            out.keyed = !tailcheck.empty();
+            if (out.version != 0 && tailcheck != check) return -6;
+            for (size_t p = 0; p < fds.size(); p++) {
+                if (fds[p] >= 0 && (out.version == 0 || has[p])) out.piecesize = std::max(out.piecesize, sizes[p]);
+            }
+            inuse.clear();
+            for (size_t p = 0; p < fds.size(); p++) {
+                if (fds[p] < 0) continue;
+                if ((out.version != 0 && !has[p]) || sizes[p] != out.piecesize) out.inconsistent.push_back(p);
+                else if (inuse.size() < cnt) inuse.push_back(p);
+            }
+            er = erasure(cnt, npar);
+            if (er.prepare(inuse) != 0) return -1;
+            uint64_t begin = 0, end = 0;
+            bool framed = false;
+            int r = locate(fds, out.piecesize, begin, end, out.hash, framed, out.filesize);
+            if (r != 0) return r;
+            // pieces of different scatters without set ids gather into noise
+            if (!hexdigest(out.hash)) {
+                out.hash.clear();
+                out.filesize = 0;
+                return -1;
+            }
+            out.format = framed ? info::FRAMED : begin == 0 ? info::STREAM : info::LEGACY;
+            return 0;
+        }
+
+        // sequential write, looping over short writes
+        static int writeAll(int fd, const char* p, size_t n) {
+            while (n != 0) {
+                ssize_t w = ::write(fd, p, n);
+                if (w < 0 && errno == EINTR) continue;
+                if (w <= 0) return -1;
+                p += w;
+                n -= static_cast<size_t>(w);
+            }
+            return 0;
+        }
+
+    private:
+
+        // scatter input
+        //  A regular file or block device is mapped and chunks point into the
+        //  mapping. Anything else (pipes, terminals) is read with large read(2)
+        //  calls straight into the chunk buffers.
+        class input {
+            int fd;
+            const char* map = nullptr;
+            size_t maplen = 0, mapoff = 0, pos = 0, size = 0;
+            bool end = false;
+        public:
+            explicit input(int fd) : fd(fd) {
+                if (fd < 0) {
+                    end = true;
+                    return;
+                }
+                struct stat sb;
+                if (fstat(fd, &sb) != 0 || !(S_ISREG(sb.st_mode) || S_ISBLK(sb.st_mode))) return;
+                off_t cur = lseek(fd, 0, SEEK_CUR);
+                off_t last = S_ISREG(sb.st_mode) ? sb.st_size : lseek(fd, 0, SEEK_END);
+                if (cur < 0 || last <= cur) return;
+                if (static_cast<uint64_t>(last - cur) > SIZE_MAX / 2) return; // beyond the address space, read(2) it
+                if (S_ISBLK(sb.st_mode)) lseek(fd, cur, SEEK_SET);
+                long pg = sysconf(_SC_PAGESIZE);
+                off_t base = cur / pg * pg;
+                maplen = static_cast<size_t>(last - base);
+                void* m = mmap(nullptr, maplen, PROT_READ, MAP_PRIVATE, fd, base);
+                if (m == MAP_FAILED) {
+                    maplen = 0;
+                    return;
+                }
+                madvise(m, maplen, MADV_SEQUENTIAL);
+                map = static_cast<const char*>(m);
+                mapoff = static_cast<size_t>(cur - base);
+                size = static_cast<size_t>(last - cur);
+            }
+            ~input() {
+                if (map != nullptr) {
+                    munmap(const_cast<char*>(map), maplen);
+                    lseek(fd, static_cast<off_t>(pos), SEEK_CUR); // consumed, like read(2) would
+                }
+            }
+            bool eof() const { return end; }
+            // point k->src at up to cap next bytes
+            int next(chunk* k, size_t cap, size_t& len) {
+                len = 0;
+                if (map != nullptr) {
+                    // k came back from the sink, drop its previous range from our RSS
+                    if (k->src >= map && k->src < map + maplen) {
+                        uintptr_t pg = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+                        uintptr_t from = (reinterpret_cast<uintptr_t>(k->src) + pg - 1) / pg * pg;
+                        uintptr_t to = (reinterpret_cast<uintptr_t>(k->src) + cap) / pg * pg;
+                        if (from < to) madvise(reinterpret_cast<void*>(from), to - from, MADV_DONTNEED);
+                    }
+                    len = std::min(cap, size - pos);
+                    k->src = map + mapoff + pos;
+                    pos += len;
+                    end = pos == size;
+                    return 0;
+                }
+                k->src = k->stream.data();
+                while (!end && len < cap) {
+                    ssize_t n = ::read(fd, k->stream.data() + len, cap - len);
+                    if (n < 0 && errno == EINTR) continue;
+                    if (n < 0) return -1;
+                    if (n == 0) end = true;
+                    len += static_cast<size_t>(n);
+                }
+                return 0;
+            }
+        };
+
+        // sha256 of the first `len` bytes of fd
+        static int digest(int fd, uint64_t len, std::string& out) {
+            hasher h;
+            std::vector<char> buf(ioengine::chunk);
+            for (uint64_t off = 0; off < len; ) {
+                ssize_t n = ::pread(fd, buf.data(), static_cast<size_t>(std::min<uint64_t>(buf.size(), len - off)), static_cast<off_t>(off));
+                if (n < 0 && errno == EINTR) continue;
+                if (n <= 0) return -1;
+                h.update(buf.data(), static_cast<size_t>(n));
+                off += static_cast<uint64_t>(n);
+            }
+            return h.final(out) ? 0 : -1;
+        }
+
+        // write `len` bytes as one frame at dst, returns the span (a multiple of
+        // `unit`); data that does not compress (or looks random) is stored
+        size_t frame(const char* src, size_t len, char* dst, size_t unit) const {
+            if (len == 0) return 0;
+            scatlib::block_frame f;
+            const size_t hl = sizeof(f);
+            size_t clen = 0;
+            codec::kind k = pack;
+            if (codec::entropy(src, len) > 7.5 || codec::compress(k, src, len, dst + hl, len, clen) != 0) {
+                k = codec::STORED;
+                std::memcpy(dst + hl, src, len);
+                clen = len;
+            }
+            f.clen = static_cast<uint32_t>(clen);
+            f.rlen = static_cast<uint32_t>(len);
+            f.codec = static_cast<uint32_t>(k);
+            f.span = static_cast<uint32_t>((hl + clen + unit - 1) / unit * unit);
+            std::memcpy(dst, &f, hl);
+            std::memset(dst + hl + clen, 0, f.span - hl - clen);
+            return f.span;
+        }
+
+        // decoder of a framed stream, fed with the data range in stream order
+        class unframer {
+            iobuf frame, out;
+            size_t fill = 0, limit;
+            scatlib::block_frame f;
+        public:
+            stats::meter md;
+            explicit unframer(size_t limit) : frame(sizeof(scatlib::block_frame)), limit(limit) {}
+            bool idle() const { return fill == 0; }
+            // returns 0, -1 broken frame, or the error of emit(p, n)
+            template <typename E> int put(const char* p, size_t n, E& emit) {
+                const size_t hl = sizeof(f);
+                while (n != 0) {
+                    size_t m = std::min(n, (fill < hl ? hl : f.span) - fill);
+                    std::memcpy(frame.data() + fill, p, m);
+                    fill += m;
+                    p += m;
+                    n -= m;
+                    if (fill == hl) {
+                        std::memcpy(&f, frame.data(), hl);
+                        if (f.span < hl + f.clen || f.span > limit || f.rlen > limit) return -1;
+                        if (frame.size() < f.span) frame.resize(f.span);
+                    }
+                    if (fill < hl || fill != f.span) continue;
+                    fill = 0;
+                    const char* payload = frame.data() + hl;
+                    if (f.codec == codec::STORED) {
+                        if (f.clen != f.rlen) return -1;
+                        int r = emit(payload, f.clen);
+                        if (r != 0) return r;
+                        continue;
+                    }
+                    if (out.size() < f.rlen) out.resize(f.rlen);
+                    md.begin();
+                    int r = codec::decompress(static_cast<codec::kind>(f.codec), payload, f.clen, out.data(), f.rlen);
+                    md.end(f.rlen);
+                    if (r != 0) return -1;
+                    r = emit(out.data(), f.rlen);
+                    if (r != 0) return r;
+                }
+                return 0;
+            }
+        };
+
+        // staging buffer for direct writes of an unaligned stream
+        class directwriter {
+            int fd;
+            bool on;
+            iobuf buf;
+            size_t fill = 0;
+        public:
+            static constexpr size_t size = 1 << 20;
+            directwriter(int fd, bool on) : fd(fd), on(on && ioengine::direct(fd, true) == 0) {
+                if (this->on) buf.resize(size);
+            }
+            int put(const char* p, size_t n) {
+                if (!on) return writeAll(fd, p, n);
+                while (n != 0) {
+                    size_t m = std::min(n, buf.size() - fill);
+                    std::memcpy(buf.data() + fill, p, m);
+                    fill += m;
+                    p += m;
+                    n -= m;
+                    if (fill == buf.size()) {
+                        if (writeAll(fd, buf.data(), fill) != 0) return -1;
+                        fill = 0;
+                    }
+                }
+                return 0;
+            }
+            // aligned part directly, then the tail through the page cache
+            int finish() {
+                if (!on) return 0;
+                size_t head = fill / ioengine::align * ioengine::align;
+                if (head != 0 && writeAll(fd, buf.data(), head) != 0) return -1;
+                if (fill != head) {
+                    if (ioengine::direct(fd, false) != 0) return -1;
+                    if (writeAll(fd, buf.data() + head, fill - head) != 0) return -1;
+                }
+                fill = 0;
+                return 0;
+            }
+        };
+
+        // a larger pipe takes the output in fewer, larger writes
+        //  Writes copy into the pipe: lending the chunk pages (vmsplice) is
+        //  not safe, a reader that splices them onward keeps them referenced
+        //  after the chunk is reused.
+        static void widen(int fd) {
+#if defined(__linux__) && defined(F_SETPIPE_SZ)
+            fcntl(fd, F_SETPIPE_SZ, 1 << 20); // best effort, bounded by pipe-max-size
+#else
+            (void)fd;
+#endif
+        }
+
+        // switch the piece files to direct I/O, all or none
+        bool enableDirect(const std::vector<int>& fds) {
+            if (fds.empty()) return false;
+            for (size_t i = 0; i < fds.size(); i++) {
+                if (ioengine::direct(fds[i], true) != 0) {
+                    for (size_t k = 0; k < i; k++) ioengine::direct(fds[k], false);
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        // run requests; under direct I/O an unaligned tail (only the last chunk
+        // has one) goes through the page cache once the aligned part is done
+        int transfer(std::vector<ioengine::request>& reqs, bool dio) {
+            if (!dio || !ioengine::alignedDirect()) return io.run(reqs);
+            thread_local std::vector<ioengine::request> tails;
+            tails.clear();
+            for (auto& r : reqs) {
+                size_t head = r.len / ioengine::align * ioengine::align;
+                if (head == r.len) continue;
+                ioengine::request t = r;
+                t.buf += head;
+                t.off += head;
+                t.len -= head;
+                tails.push_back(t);
+                r.len = head;
+            }
+            int ret = io.run(reqs);
+            if (ret != 0 || tails.empty()) return ret;
+            for (auto& t : tails) {
+                if (ioengine::direct(t.fd, false) != 0) return -EINVAL;
+            }
+            return io.run(tails);
+        }
+
+        // choose the piece chunk size and the worker count so that the buffers
+        // stay within the budget, the largest chunks first, then fewer workers
+        // (cost(pc, w) is the buffer bytes of a choice)
+        //  returns 0, -5 when nothing fits
+        template <typename C> int plan(size_t minchunk, C cost) {
+            pchunk = piecechunk;
+            active = workers;
+            if (budget == 0) return 0;
+            size_t avail = budget > memory::reserve ? budget - memory::reserve : 0;
+            for (size_t pc = piecechunk; pc >= minchunk; pc /= 2) {
+                for (unsigned w = workers; w >= 1; w--) {
+                    if (cost(pc, w) > avail) continue;
+                    pchunk = pc;
+                    active = w;
+                    return 0;
+                }
+            }
+            return -5;
+        }
+
+        // one gather pass, the pieces in skip left out; pieces whose digest
+        // fails on the way are added to skip, wrote tells whether any output
+        // was written
+        int pass(const std::vector<int>& fds, int outfd, std::vector<size_t>& skip, bool& wrote, result& res) {
+            const size_t cnt = ma.size();
+            res = result();
+            if (fds.size() != cnt + npar) return -1;
+
+            // sizes and piece tails, broken pieces are left out and pieces
+            // shorter than the longest one are truncated
+            std::vector<uint64_t> sizes;
+            bool tagged = false;
+            if (tails(fds, sizes, tagged, res.broken) != 0) return -4;
+            if (tagged && tailcheck != check) return -6;
+            res.tagged = tagged;
+            for (auto p : skip) {
+                if (std::find(res.broken.begin(), res.broken.end(), p) == res.broken.end()) res.broken.push_back(p);
+            }
+            std::sort(res.broken.begin(), res.broken.end());
+            std::vector<bool> bad(fds.size(), false);
+            for (auto p : res.broken) bad[p] = true;
+            uint64_t plen = 0;
+            for (size_t p = 0; p < fds.size(); p++) {
+                if (fds[p] >= 0 && !bad[p]) plen = std::max(plen, sizes[p]);
+            }
+            res.piecesize = plen;
+
+            // the first intact pieces (data pieces need no rebuilding)
+            inuse.clear();
+            std::vector<int> ufds;
+            for (size_t p = 0; p < fds.size() && inuse.size() < cnt; p++) {
+                if (fds[p] < 0 || bad[p] || sizes[p] != plen) continue;
+                inuse.push_back(p);
+                ufds.push_back(fds[p]);
+            }
+            er = erasure(cnt, npar);
+            if (er.prepare(inuse) != 0) return -1; // illegal file error
+            res.rebuilt = er.missing();
+
+            // metadata (trailer, or the header of the former in-memory format)
+            uint64_t begin = 0, end = 0;
+            std::string mhash;
+            bool framed = false;
+            if (segmented) {
+                for (auto& x : segs) {
+                    if (x.poff + x.plen > plen || x.plen > piecechunk || x.len > x.plen * cnt) return -1;
+                }
+                mhash = seghash;
+                res.filesize = segsize;
+                if (segs.empty()) {
+                    hasher h;
+                    if (!h.final(res.hash)) return -2;
+                    return res.hash.compare(mhash) != 0 ? -3 : 0;
+                }
+            }
+            else {
+                int r = locate(fds, plen, begin, end, mhash, framed, res.filesize);
+                // a trailer that does not read may be a broken piece in use
+                if (r == -1 && tagged) {
+                    for (auto p : digests(fds, inuse)) {
+                        skip.push_back(p);
+                        res.broken.push_back(p);
+                    }
+                    std::sort(res.broken.begin(), res.broken.end());
+                }
+                if (r != 0) return r;
+            }
+
+            struct stat ob;
+            bool regular = outfd >= 0 && fstat(outfd, &ob) == 0 && S_ISREG(ob.st_mode);
+            if (outfd >= 0 && S_ISFIFO(ob.st_mode)) widen(outfd);
+            // frames are sized by the scatter side
+            size_t fixed = (framed ? 2 * (sizeof(scatlib::block_frame) + piecechunk * cnt + cnt * ioengine::align) : 0)
+                           + (direct && regular ? directwriter::size : 0);
+            size_t minchunk = ioengine::align;
+            for (auto& x : segs) minchunk = std::max(minchunk, x.plen);
+            int ret = plan(minchunk, [&](size_t pc, unsigned w) {
+                return (w * 2 + 2) * chunkBytes(pc * cnt, pc, 0) + fixed;
+            });
+            if (ret != 0) return ret;
+            if (init(pchunk * cnt, pchunk) != 0) return -5;
+            res.direct = direct && !segmented && enableDirect(ufds); // segments are not aligned
+            directwriter dw(outfd, direct && regular);
+
+            // source: read a column range (or the next segment) of every piece
+            auto source = [&]() {
+                stats::meter mr;
+                std::vector<ioengine::request> reqs;
+                uint64_t poff = 0;
+                for (uint64_t seq = 0; segmented ? seq < segs.size() : poff < plen; seq++) {
+                    chunk* k;
+                    if (!freed->pop(k, abort)) break;
+                    if (segmented) poff = segs[seq].poff;
+                    size_t n = segmented ? segs[seq].plen : static_cast<size_t>(std::min<uint64_t>(pchunk, plen - poff));
+                    reqs.clear();
+                    for (auto p : inuse) {
+                        reqs.push_back(ioengine::request{fds[p], k->pieces[p].data(), n, poff, false});
+                    }
+                    mr.begin();
+                    int r = transfer(reqs, res.direct);
+                    mr.end(n * cnt);
+                    if (r != 0) {
+                        fail(r == -EIO ? -1 : -4);
+                        break;
+                    }
+                    k->seq = seq;
+                    k->soff = poff * cnt;
+                    k->len = n * cnt;
+                    poff += n;
+                    k->last = segmented ? seq + 1 == segs.size() : poff == plen;
+                    if (!work->push(k, abort)) break;
+                }
+                for (unsigned i = 0; i < active; i++) work->push(nullptr, abort);
+                if (st != nullptr) st->add("read", mr);
+            };
+
+            // the data range of a chunk in stream offsets
+            auto window = [&](const chunk* k, uint64_t& from, uint64_t& to) {
+                from = std::max(begin, k->soff);
+                to = std::min(end, k->soff + k->len);
+                if (segmented) {
+                    from = k->soff;
+                    to = k->soff + segs[k->seq].len;
+                }
+            };
+
+            // plain streams are hashed by the kernels, in stream order, frames
+            // only once the sink decoded them
+            hasher h;
+            std::atomic<uint64_t> turn{0}; // next chunk to hash
+
+            // kernel (rebuild, gather and hash a cache-sized block at a time; the
+            // chunk next in stream order hashes its data while it is still in
+            // cache, the others hash theirs once their turn comes)
+            auto kernel = [&]() {
+                stats::meter mk, me, mt;
+                std::vector<char*> bufs(cnt + npar), sub(cnt + npar);
+                const size_t step = std::max(width, fuseblock / (cnt * width) * width), stripe = striping();
+                chunk* k;
+                while (work->pop(k, abort) && k != nullptr) {
+                    for (size_t p = 0; p < cnt + npar; p++) bufs[p] = k->pieces[p].data();
+                    uint64_t from, to;
+                    window(k, from, to);
+                    uint64_t hashed = from; // stream offset hashed so far
+                    auto feed = [&](uint64_t upto) {
+                        upto = std::min(upto, to);
+                        if (upto <= hashed) return;
+                        mt.begin();
+                        h.update(k->stream.data() + (hashed - k->soff), static_cast<size_t>(upto - hashed));
+                        mt.end(upto - hashed);
+                        hashed = upto;
+                    };
+                    const size_t plen = k->len / cnt;
+                    for (size_t off = 0; off < plen; off += step) {
+                        size_t n = std::min(step, plen - off);
+                        for (size_t p = 0; p < cnt + npar; p++) sub[p] = bufs[p] + off;
+                        if (!res.rebuilt.empty()) {
+                            me.begin();
+                            er.rebuild(sub.data(), n);
+                            me.end(n * res.rebuilt.size());
+                        }
+                        mk.begin();
+                        lib.gatherBlock(sub.data(), n, ma, k->stream.data() + off * cnt, stripe);
+                        mk.end(n * cnt);
+                        if (!framed && turn.load(std::memory_order_acquire) == k->seq) feed(k->soff + (off + n) * cnt);
+                    }
+                    if (!framed) {
+                        bool ready = true;
+                        for (unsigned w = 0; turn.load(std::memory_order_acquire) != k->seq; w++) {
+                            if (abort.load(std::memory_order_relaxed)) {
+                                ready = false;
+                                break;
+                            }
+                            ring<chunk*>::backoff(w);
+                        }
+                        if (!ready) break;
+                        feed(to);
+                        turn.store(k->seq + 1, std::memory_order_release);
+                    }
+                    if (!done->push(k, abort)) break;
+                }
+                if (st != nullptr) {
+                    st->add("kernel", mk);
+                    if (!res.rebuilt.empty()) st->add("rebuild", me);
+                    if (!framed) st->add("hash", mt);
+                }
+            };
+
+            // sink: trim to the data range, decode and hash frames, write in
+            // order; the pieces read are digested on the way (tails)
+            std::vector<size_t> mismatch;
+            auto sink = [&]() {
+                stats::meter mw, mh, mv;
+                std::vector<hasher> ph(tagged ? fds.size() : 0);
+                unframer uf(sizeof(scatlib::block_frame) + piecechunk * cnt + cnt * ioengine::align);
+                auto emit = [&](const char* p, size_t n) {
+                    if (framed) {
+                        mh.begin();
+                        h.update(p, n);
+                        mh.end(n);
+                    }
+                    if (outfd < 0) return 0;
+                    wrote = true;
+                    mw.begin();
+                    int r = dw.put(p, n);
+                    mw.end(n);
+                    return r != 0 ? -4 : 0;
+                };
+                std::vector<chunk*> ready;
+                for (bool last = false; !last; ) {
+                    if (!nextInOrder(ready)) return;
+                    for (auto k : ready) {
+                        uint64_t from, to;
+                        window(k, from, to);
+                        if (from < to) {
+                            const char* p = k->stream.data() + (from - k->soff);
+                            size_t n = static_cast<size_t>(to - from);
+                            int r = framed ? uf.put(p, n, emit) : emit(p, n);
+                            if (r != 0) {
+                                fail(r);
+                                return;
+                            }
+                        }
+                        if (tagged) {
+                            const size_t n = k->len / cnt;
+                            mv.begin();
+                            for (auto p : inuse) ph[p].update(k->pieces[p].data(), n);
+                            mv.end(n * inuse.size());
+                        }
+                        last = last || k->last;
+                        freed->push(k, abort);
+                    }
+                }
+                if (tagged) {
+                    if (st != nullptr) st->add("validate", mv);
+                    for (auto p : inuse) {
+                        std::string d;
+                        if (!ph[p].final(d)) {
+                            fail(-2);
+                            return;
+                        }
+                        if (d.compare(0, 64, ptails[p].digest, 64) != 0) mismatch.push_back(p);
+                    }
+                    if (!mismatch.empty()) {
+                        fail(-1);
+                        return;
+                    }
+                }
+                mw.begin();
+                if (dw.finish() != 0) {
+                    fail(-4);
+                    return;
+                }
+                mw.end(0);
+                if (!uf.idle()) fail(-1); // truncated frame
+                else if (!h.final(res.hash)) fail(-2);
+                else if (res.hash.compare(mhash) != 0) fail(-3);
+                if (st != nullptr) {
+                    st->add("write", mw);
+                    if (framed) {
+                        st->add("hash", mh);
+                        st->add("decompress", uf.md);
+                    }
+                }
+            };
+
+            int r = run(source, kernel, sink);
+            for (auto p : mismatch) {
+                skip.push_back(p);
+                res.broken.push_back(p);
+            }
+            std::sort(res.broken.begin(), res.broken.end());
+            return r;
+        }
+
+        // the pieces of `which` that fail their digests, checked in parallel on
+        // the executor
+        std::vector<size_t> digests(const std::vector<int>& fds, const std::vector<size_t>& which) {
+            std::vector<char> ok(fds.size(), 0);
+            // the stage is the elapsed time of the checks, its cpu time theirs
+            std::vector<stats::meter> mv(fds.size());
+            stats::meter mg;
+            mg.begin();
+            executor::group g(ex, static_cast<long>(node));
+            for (auto p : which) {
+                g.start([&, p]() {
+                    std::string d;
+                    mv[p].begin();
+                    ok[p] = digest(fds[p], ptails[p].length, d) == 0 && d.compare(0, 64, ptails[p].digest, 64) == 0;
+                    mv[p].end(ptails[p].length);
+                });
+            }
+            g.wait();
+            mg.end(0);
+            if (st != nullptr && !which.empty()) {
+                double cpu = 0;
+                for (auto& m : mv) {
+                    cpu += m.cpu;
+                    mg.bytes += m.bytes;
+                }
+                st->add("validate", mg.wall, cpu, mg.bytes);
+            }
+            std::vector<size_t> bad;
+            for (auto p : which) {
+                if (!ok[p]) bad.push_back(p);
+            }
+            return bad;
+        }
+
+        // take the set most usable tails agree on (interleave, set id, key
+        // check and piece length, the first one on a tie), tails of
+        // another set are dropped from has; tailcheck is the key check of the set
+        //  returns 0, -4 I/O error
+        int pick(const std::vector<scatlib::piece_tail>& tails, const std::vector<scatlib::piece_set>& sets, std::vector<char>& has) {
+            auto same = [&](size_t a, size_t b) {
+                const scatlib::piece_tail& x = tails[a];
+                const scatlib::piece_tail& y = tails[b];
+                return x.length == y.length && x.grain == y.grain && x.width == y.width && sets[a].flags == sets[b].flags
+                       && std::memcmp(sets[a].id, sets[b].id, sizeof(sets[a].id)) == 0
+                       && std::memcmp(sets[a].check, sets[b].check, sizeof(sets[a].check)) == 0;
+            };
+            long best = -1;
+            size_t votes = 0;
+            for (size_t p = 0; p < tails.size(); p++) {
+                if (!has[p] || !usable(tails[p])) continue;
+                size_t v = 0;
+                for (size_t q = 0; q < tails.size(); q++) v += has[q] && same(p, q);
+                if (v > votes) {
+                    best = static_cast<long>(p);
+                    votes = v;
+                }
+            }
+            for (size_t p = 0; p < tails.size(); p++) has[p] = has[p] && best >= 0 && same(static_cast<size_t>(best), p);
+            tailcheck.clear();
+            if (best < 0) return interleave(scatlib::GRAIN_BIT) == 0 ? 0 : -4;
+            const size_t b = static_cast<size_t>(best);
+            if (interleave(tails[b]) != 0) return -4;
+            if (sets[b].flags & scatlib::SET_KEYED) tailcheck.assign(sets[b].check, 64);
+            return 0;
+        }
+
+        // whether h is a sha256 as the trailers hold it (64 lowercase hex digits)
+        static bool hexdigest(const std::string& h) {
+            if (h.size() != 64) return false;
+            for (char c : h) {
+                if ((c < '0' || c > '9') && (c < 'a' || c > 'f')) return false;
+            }
+            return true;
+        }
+
+        // whether a tail records an interleave this build knows
+        static bool usable(const scatlib::piece_tail& t) {
+            return t.grain <= scatlib::GRAIN_BLOCK && t.width != 0 && t.width <= scatlib::maxwidth && (t.width & (t.width - 1)) == 0;
+        }
+
+        // piece bytes per group when striping whole bytes, 0 for the masks
+        //  (the masks of byte interleave stripe as well, for 8 pieces their
+        //  transposing kernels are the faster way)
+        size_t striping() const {
+            if (grain == scatlib::GRAIN_BYTE) return ma.size() == 8 ? 0 : 1;
+            return grain == scatlib::GRAIN_BLOCK ? width : 0;
+        }
+
+        // take the interleave a piece tail records
+        //  returns 0, -1 not a valid one
+        int interleave(const scatlib::piece_tail& t) {
+            return interleave(static_cast<scatlib::grain>(t.grain), t.width);
+        }
+
+        static size_t aligned(size_t n) { return (n + ioengine::align - 1) / ioengine::align * ioengine::align; }
+
+        // bytes of one chunk of the pool
+        size_t chunkBytes(size_t streamcap, size_t piececap, size_t packcap) const {
+            return aligned(streamcap) + (ma.size() + npar) * aligned(piececap) + aligned(packcap);
+        }
+
+        // allocate the chunk pool: enough to keep every stage busy
+        //  every chunk is one slot of the arena (stream, pieces, then packed),
+        //  a pool of the same shape is kept for the next job
+        //  returns 0, -5 the arena could not be mapped
+        int init(size_t streamcap, size_t piececap, size_t extra = 0, size_t packcap = 0) {
+            const size_t cnt = ma.size();
+            piececap = aligned(piececap);
+            size_t n = active * 2 + 2 + extra;
+            if (pool.size() != n || pool[0]->stream.size() != streamcap || pool[0]->pieces[0].size() != piececap
+                || pool[0]->pieces.size() != cnt + npar || pool[0]->packed.size() != packcap || placed != ex.nodeId(node)) {
+                pool.clear();
+                if (mem.reserve(chunkBytes(streamcap, piececap, packcap), n, huge) != 0) return -5;
+                placed = ex.nodeId(node);
+                mem.prefer(placed);
+                for (size_t i = 0; i < n; i++) {
+                    std::unique_ptr<chunk> k(new chunk());
+                    char* p = mem.take();
+                    k->stream = arena::span{p, streamcap};
+                    p += aligned(streamcap);
+                    for (size_t q = 0; q < cnt + npar; q++, p += piececap) k->pieces.push_back(arena::span{p, piececap});
+                    k->packed = arena::span{p, packcap};
+                    pool.push_back(std::move(k));
+                }
+            }
+            freed.reset(new ring<chunk*>(n));
+            work.reset(new ring<chunk*>(n + active));
+            done.reset(new ring<chunk*>(n));
+            for (auto& k : pool) freed->tryPush(k.get());
+            slots.assign(n, nullptr);
+            nextseq = 0;
+            abort = false;
+            err = 0;
+
+            std::vector<std::pair<char*, size_t>> pins;
+            for (auto& k : pool) pins.push_back(std::make_pair(k->stream.data(), mem.slotSize()));
+            io.pin(pins);
+            return 0;
+        }
+
+        void fail(int e) {
+            int expected = 0;
+            err.compare_exchange_strong(expected, e);
+            abort = true;
+        }
+
+        // sink side: wait for the next chunk in stream order, then take every
+        // chunk that is consecutive to it
+        bool nextInOrder(std::vector<chunk*>& ready) {
+            ready.clear();
+            const size_t n = slots.size();
+            while (slots[nextseq % n] == nullptr) {
+                chunk* k;
+                if (!done->pop(k, abort)) return false;
+                slots[k->seq % n] = k;
+            }
+            chunk* k;
+            while (done->tryPop(k)) slots[k->seq % n] = k;
+            while (slots[nextseq % n] != nullptr) {
+                chunk* c = slots[nextseq % n];
+                slots[nextseq % n] = nullptr;
+                nextseq++;
+                ready.push_back(c);
+                if (c->last) break;
+            }
+            return true;
+        }
+
+        // every stage on the executor, a kernel per worker slot (a CPU of
+        // its own with affinity)
+        template <typename S, typename K, typename W>
+        int run(S& source, K& kernel, W& sink) {
+            executor::group g(ex, static_cast<long>(node));
+            g.start([&]() { source(); });
+            for (unsigned i = 0; i < active; i++) g.start([&]() { kernel(); }, static_cast<long>(i));
+            g.start([&]() {
+                sink();
+                if (err == 0 && abort) err = -4;
+                abort = true; // release the source and workers if the sink bailed out
+            });
+            g.wait();
+            return err;
+        }
+
+        // find the data range in stream coordinates and its hash
+        //  framed streams hold the frames in the range and `size` is the decoded size
+        int locate(const std::vector<int>& fds, uint64_t plen, uint64_t& begin, uint64_t& end, std::string& mhash,
+                   bool& framed, uint64_t& size) {
+            const size_t cnt = ma.size(), group = cnt * width;
+            const uint64_t slen = plen * cnt;
+            const size_t metalen = sizeof(scatlib::block_tail);
+            if (slen < metalen || plen % width != 0) return -1;
+
+            // read `n` columns from `poff` of the pieces in use and gather them
+            auto columns = [&](uint64_t poff, size_t n, std::vector<char>& out) {
+                std::vector<std::vector<char>> bufs(cnt + npar, std::vector<char>(n));
+                std::vector<char*> src(cnt + npar);
+                std::vector<ioengine::request> reqs;
+                for (size_t p = 0; p < cnt + npar; p++) src[p] = bufs[p].data();
+                for (auto p : inuse) reqs.push_back(ioengine::request{fds[p], src[p], n, poff, false});
+                if (io.run(reqs) != 0) return -4;
+                er.rebuild(src.data(), n);
+                out.resize(n * cnt);
+                lib.gatherBlock(src.data(), n, ma, out.data(), striping());
+                return 0;
+            };
+            size_t ncol = static_cast<size_t>(std::min<uint64_t>(plen, ((metalen + group - 1) / group + 1) * width));
+            std::vector<char> buf;
+
+            // streamed: data, zero pad, block_tail
+            if (columns(plen - ncol, ncol, buf) != 0) return -4;
+            scatlib::block_tail tail;
+            std::memcpy(&tail, &buf[buf.size() - metalen], metalen);
+            bool trailer = tail.s == 'D' && tail.i == 'S' && tail.g == 'C' && tail.n == '2';
+            if (trailer && (tail.flags & scatlib::TAIL_FRAMED) != 0) {
+                size_t pad = (group - metalen % group) % group;
+                if (slen < metalen + pad) return -1;
+                begin = 0;
+                end = slen - metalen - pad;
+                framed = true;
+                size = tail.filesize;
+                mhash.assign(tail.hash, 64);
+                return 0;
+            }
+            if (trailer && tail.filesize + metalen <= slen && slen - tail.filesize - metalen < group) {
+                begin = 0;
+                end = size = tail.filesize;
+                mhash.assign(tail.hash, 64);
+                return 0;
+            }
+
+            // in-memory: block_meta, data, zero pad
+            if (columns(0, ncol, buf) != 0) return -4;
+            scatlib::block_meta meta;
+            std::memcpy(&meta, buf.data(), sizeof(meta));
+            if (meta.s == 'D' && meta.i == 'S' && meta.g == 'C' && meta.n == 'T'
+                && sizeof(meta) + meta.filesize <= slen) {
+                begin = sizeof(meta);
+                end = begin + meta.filesize;
+                size = meta.filesize;
+                mhash.assign(meta.hash, 64);
+                return 0;
+            }
+            return -1; // illegal file error
+        }
+
+        std::vector<uint8_t> ma;
+        ioengine& io;
+        executor& ex;
+        size_t node = 0;
+        int placed = -1;          // node of the pool memory
+        unsigned workers, active; // requested, and in use within the budget
+        stats* st;
+        bool direct = false;
+        bool huge = false;
+        size_t budget = 0;
+        size_t pchunk = piecechunk;
+        scatlib::grain grain = scatlib::GRAIN_BIT;
+        size_t width = 1; // piece bytes per group
+        std::string secret, check; // key of the schedule and its check
+        std::string tailcheck;     // key check of the pieces (pick)
+        codec::kind pack = codec::STORED;
+        size_t npar = 0;
+        erasure er;
+        std::vector<size_t> inuse; // pieces read by gather
+        std::vector<scatlib::piece_tail> ptails; // of the pieces (tails)
+        std::vector<char> phas;    // pieces with a tail of the set (tails)
+        std::vector<extent> segs;  // segments to gather (incremental scatter)
+        bool segmented = false;
+        uint64_t segsize = 0;
+        std::string seghash;
+        scatlib lib;
+
+        arena mem; // storage of the pool
+        std::vector<std::unique_ptr<chunk>> pool;
+        std::unique_ptr<ring<chunk*>> freed, work, done;
+        std::vector<chunk*> slots; // reorder window of the sink
+        uint64_t nextseq = 0;
+        std::atomic<bool> abort{false};
+        std::atomic<int> err{0};
+
+    };
+
+} // ns::dscat
+
+#endif //DSCAT_LIB_PIPELINE_HPP
@@ -26,18 +26,38 @@
 #ifndef DSCAT_LIB_SCATLIB_HPP
 #define DSCAT_LIB_SCATLIB_HPP
 
+#include <algorithm>
+#include <cstring>
 #include <string>
 #include <vector>
 #include "hash.hpp"
 
+// DSCAT_SCATLIB_SCALAR leaves out the SIMD kernels, DSCAT_SCATLIB_NO_GFNI
+// the AVX-512 ones (the kernel tests build every variant)
+#if defined(__SSE2__) && !defined(DSCAT_SCATLIB_SCALAR)
+#include <emmintrin.h>
+#define DSCAT_SCATLIB_SSE2
+#endif
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(DSCAT_SCATLIB_SCALAR) && !defined(DSCAT_SCATLIB_NO_GFNI)
+#include <immintrin.h>
+#define DSCAT_SCATLIB_GFNI
+#endif
+
 namespace dscat {
 
     class scatlib {
 
     public:
 
+        // interleave granularity
+        //  bit and nibble run through the masks, byte and block stripe whole
+        //  bytes (a block is `width` bytes of each piece per group)
+        enum grain : uint16_t { GRAIN_BIT = 0, GRAIN_NIBBLE, GRAIN_BYTE, GRAIN_BLOCK };
+
+        static constexpr size_t maxwidth = 4096; // block width, a power of 2 up to this
+
         template <typename T>
-        int makeMasks(std::vector<T>& ma, int count) {
+        int makeMasks(std::vector<T>& ma, int count, grain gr = GRAIN_BIT) {
 
             // allocate work
             const int maxbits = sizeof(T) * 8;
@@ -46,13 +66,14 @@ namespace dscat {
             // bound check
             if (count > maxbits || count < 2) return -1;
 
-            // make mask
+            // make mask (bits, nibbles or whole bytes round robin)
+            const int span = gr == GRAIN_BIT ? 1 : gr == GRAIN_NIBBLE ? 4 : 8;
             int mi = 0;
-            int rv = 1;
-            for (int i = 0; i < maxbits; i++) {
-                lm[mi] += rv;
+            T rv = (T(1) << span) - 1;
+            for (int i = 0; i < maxbits; i += span) {
+                lm[mi] |= rv;
                 if (mi == count - 1) mi = 0; else mi++;
-                rv <<= 1;
+                rv <<= span;
             }
 
             // succeeded
@@ -71,113 +92,507 @@ namespace dscat {
             char hash[64] = {0};
         } block_meta;
 
-        typedef std::vector<uint8_t> blocks;
-        int scatString(std::vector<char>& src, std::vector<uint8_t >& maskarray, std::vector<std::string>& output) {
+        // trailer of a streamed scatter (the stream is data + zero pad + block_tail,
+        // padded so that it ends on a group boundary)
+        typedef struct {
+            char s = 'D';
+            char i = 'S';
+            char g = 'C';
+            char n = '2';
+            uint32_t flags = 0; // TAIL_FRAMED: data region is a sequence of block_frame
+            uint64_t filesize = 0;
+            char hash[64] = {0};
+        } block_tail;
+
+        static constexpr uint32_t TAIL_FRAMED = 1;
 
-            // init
-            auto apply_output = [&output](blocks bufs) {
-                int idx = 0;
-                for (auto c : bufs) {
-                    output[idx++] += c;
+        // trailer of every piece of a streamed scatter, after the piece bytes
+        // and the piece_set
+        typedef struct {
+            char s = 'D';
+            char i = 'S';
+            char g = 'C';
+            char n = 'P';
+            uint32_t version = 1;
+            uint32_t index = 0;  // piece number from 0, data pieces then parity pieces
+            uint32_t count = 0;  // data pieces of the set
+            uint32_t parity = 0; // parity pieces of the set
+            uint16_t grain = 0;  // interleave granularity
+            uint16_t width = 0;  // piece bytes per group of a block interleave
+            uint64_t length = 0; // piece bytes before the trailer
+            char digest[64] = {0}; // sha256 of those bytes
+        } piece_tail;
+
+        // set record between the piece bytes and the piece_tail: the pieces of
+        // one scatter share its id
+        typedef struct {
+            char s = 'D';
+            char i = 'S';
+            char g = 'C';
+            char n = 'S';
+            uint32_t flags = 0;   // SET_KEYED: check holds the key check
+            char id[16] = {0};    // random per scatter
+            char check[64] = {0}; // keyCheck() of the key
+        } piece_set;
+
+        static constexpr uint32_t SET_KEYED = 1;
+
+        // keyed schedule
+        //  Instead of the round robin of the masks, every unit of the interleave
+        //  (a bit, or a nibble) takes its own permutation of the pieces over the
+        //  bytes of a group, drawn from the key: with 8 pieces (8!)^8 schedules.
+        //  It only changes the tables of the kernels, so it costs nothing per
+        //  byte. An empty key is the round robin again.
+        //  The draws reject the top of the 32-bit range so that every
+        //  permutation is equally likely.
+        //  returns 0, -1 not a masked granularity, -2 hashing error
+        int keySchedule(const std::string& key, size_t count, grain gr) {
+            keyed = false;
+            if (key.empty()) return 0;
+            if ((gr != GRAIN_BIT && gr != GRAIN_NIBBLE) || count < 2 || count > 8) return -1;
+            std::string seed;
+            if (!dscat::computeHash(key, seed)) return -2;
+            std::string pool;
+            size_t used = 0, block = 0;
+            auto draw = [&](size_t n) -> size_t { // below n (n <= 8)
+                const uint32_t limit = static_cast<uint32_t>(0x100000000ull / n * n - 1);
+                for (;;) {
+                    if (used + 8 > pool.size()) {
+                        if (!dscat::computeHash(seed + ":" + std::to_string(block++), pool)) return n;
+                        used = 0;
+                    }
+                    uint32_t v = static_cast<uint32_t>(std::stoul(pool.substr(used, 8), nullptr, 16));
+                    used += 8;
+                    if (v <= limit) return v % n;
                 }
             };
+            std::memset(kt, 0, sizeof(kt));
+            const int span = gr == GRAIN_BIT ? 1 : 4;
+            for (int b = 0; b < 8; b += span) {
+                uint8_t perm[8];
+                for (size_t p = 0; p < count; p++) perm[p] = static_cast<uint8_t>(p);
+                for (size_t p = count - 1; p > 0; p--) {
+                    size_t j = draw(p + 1);
+                    if (j > p) return -2;
+                    std::swap(perm[p], perm[j]);
+                }
+                uint8_t unit = static_cast<uint8_t>(((1 << span) - 1) << b);
+                for (size_t p = 0; p < count; p++) kt[p][perm[p]] |= unit;
+            }
+            keyed = true;
+            keycnt = count;
+            return 0;
+        }
 
-            // calc hash
-            std::string hash;
-            if (!dscat::computeHash(src, hash)) return -2; // hashing error
-
-            // make meta
-            block_meta meta;
-            meta.filesize = src.size();
-            std::memcpy(meta.hash, &hash[0], 64);
-
-            // adding meta
-            std::vector<char> vmeta(sizeof(block_meta));
-            std::memcpy(&vmeta[0], &meta, sizeof(block_meta));
-            src.resize(src.size() + sizeof(block_meta));
-            src.insert(src.begin(), vmeta.begin(), vmeta.end());
-
-            std::ofstream test("/tmp/of");
-            test << std::string(src.begin(), src.end());
-            test.close();
-
-            // bound check
-            if (output.size() != maskarray.size()) return -1; // size mismatch
-
-            // scatting
-            int rotate = 0;
-            blocks init(maskarray.size(), 0);
-            blocks buf(maskarray.size(), 0);
-            for (std::string::iterator it = src.begin(); it != src.end(); ++it ) {
+        // check value of a key, for the piece_set (it does not reveal the schedule)
+        static bool keyCheck(const std::string& key, std::string& check) {
+            std::string seed;
+            return dscat::computeHash(key, seed) && dscat::computeHash(seed + ":check", check);
+        }
 
-                int idx = 0 + rotate;
-                for (auto mask : maskarray) {
-                    buf[idx] |= mask & *it;
-                    if (++idx == maskarray.size()) idx = 0;
+        // frame of a compressed stream: header, payload and zero pad up to `span`
+        // bytes; a framed stream ends with a group-aligned block_tail
+        typedef struct {
+            uint32_t span = 0;  // header + payload + pad, a multiple of the group size
+            uint32_t clen = 0;  // payload bytes
+            uint32_t rlen = 0;  // bytes after decoding
+            uint32_t codec = 0; // codec::kind of the payload
+        } block_frame;
+
+        // scatter `len` stream bytes into the pieces, one byte per piece for each
+        // group of maskarray.size() bytes (a short last group is zero filled),
+        // or `stripe` bytes per piece for each group of stripe * maskarray.size()
+        // bytes when striping;
+        //  kept out of line, inlined into the pipeline kernel it runs ~40% slower
+        __attribute__((noinline)) void scatBlock(const char* src, size_t len, const std::vector<uint8_t>& maskarray, char* const* dst,
+                                                 size_t stripe = 0) {
+            const size_t cnt = maskarray.size();
+            if (stripe != 0) {
+                scatStripe(src, len, cnt, stripe, dst);
+                return;
+            }
+            uint8_t mt[8][8]; // mt[p][r] : bits of byte r going to piece p
+            for (size_t p = 0; p < cnt; p++) {
+                for (size_t r = 0; r < cnt; r++) mt[p][r] = keyed && keycnt == cnt ? kt[p][r] : maskarray[(p + cnt - r) % cnt];
+            }
+            size_t groups = len / cnt, g = 0;
+            if (cnt == 8) {
+#ifdef DSCAT_SCATLIB_GFNI
+                if (gfni()) g = scat8Gfni(src, groups, mt, dst);
+#endif
+                g = scat8(src, g, groups, mt, dst);
+            }
+            for (; g < groups; g++) {
+                const uint8_t* in = reinterpret_cast<const uint8_t*>(src) + g * cnt;
+                for (size_t p = 0; p < cnt; p++) {
+                    uint8_t v = 0;
+                    for (size_t r = 0; r < cnt; r++) v |= in[r] & mt[p][r];
+                    dst[p][g] = static_cast<char>(v);
                 }
-                if (++rotate == maskarray.size()) {
-                    apply_output(buf);
-                    buf = init;
-                    rotate = 0;
+            }
+            if (len % cnt != 0) {
+                uint8_t in[8] = {0};
+                std::memcpy(in, src + groups * cnt, len % cnt);
+                for (size_t p = 0; p < cnt; p++) {
+                    uint8_t v = 0;
+                    for (size_t r = 0; r < cnt; r++) v |= in[r] & mt[p][r];
+                    dst[p][groups] = static_cast<char>(v);
                 }
-
             }
-            if (rotate != 0) apply_output(buf);
+        }
 
-            // succeeded
-            return 0;
+        // gather `plen` bytes of every piece into plen * maskarray.size() stream bytes
+        // (plen a multiple of stripe when striping)
+        //  (out of line like scatBlock)
+        __attribute__((noinline)) void gatherBlock(const char* const* srcs, size_t plen, const std::vector<uint8_t>& maskarray, char* dst,
+                                                   size_t stripe = 0) {
+            const size_t cnt = maskarray.size();
+            if (stripe != 0) {
+                gatherStripe(srcs, plen, cnt, stripe, dst);
+                return;
+            }
+            uint8_t mt[8][8]; // mt[k][p] : bits of piece p going to byte k
+            for (size_t k = 0; k < cnt; k++) {
+                for (size_t p = 0; p < cnt; p++) mt[k][p] = keyed && keycnt == cnt ? kt[p][k] : maskarray[(p + cnt - k) % cnt];
+            }
+            size_t g = 0;
+            if (cnt == 8) {
+#ifdef DSCAT_SCATLIB_GFNI
+                if (gfni()) g = gather8Gfni(srcs, plen, mt, dst);
+#endif
+                g = gather8(srcs, g, plen, mt, dst);
+            }
+            for (; g < plen; g++) {
+                uint8_t in[8];
+                for (size_t p = 0; p < cnt; p++) in[p] = static_cast<uint8_t>(srcs[p][g]);
+                for (size_t k = 0; k < cnt; k++) {
+                    uint8_t v = 0;
+                    for (size_t p = 0; p < cnt; p++) v |= in[p] & mt[k][p];
+                    dst[g * cnt + k] = static_cast<char>(v);
+                }
+            }
+        }
 
+        // kernels of 8 pieces in use: gfni, sse2, swar (64-bit words) or generic
+        static const char* kernels() {
+#ifdef DSCAT_SCATLIB_GFNI
+            if (gfni()) return "gfni";
+#endif
+#ifdef DSCAT_SCATLIB_SSE2
+            return "sse2";
+#elif defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            return "swar";
+#else
+            return "generic";
+#endif
         }
 
-        int gatherString(std::vector<std::string>& srcs, int destlen, std::vector<uint8_t >& maskarray, std::vector<char>& dest) {
+    private:
 
-            // check size
-            int baselen = srcs[0].length();
-            for (auto s : srcs) {
-                if (s.length() != baselen) return -1; // illegal file error
+        // striping, a copy of every `w` bytes (bytes one at a time)
+        static void scatStripe(const char* src, size_t len, size_t cnt, size_t w, char* const* dst) {
+            const size_t group = cnt * w, groups = len / group;
+            if (w == 1) {
+                for (size_t g = 0; g < groups; g++) {
+                    for (size_t p = 0; p < cnt; p++) dst[p][g] = src[g * cnt + p];
+                }
             }
+            else {
+                for (size_t g = 0; g < groups; g++) {
+                    for (size_t p = 0; p < cnt; p++) std::memcpy(dst[p] + g * w, src + g * group + p * w, w);
+                }
+            }
+            size_t rest = len - groups * group;
+            if (rest == 0) return;
+            for (size_t p = 0; p < cnt; p++) {
+                size_t from = std::min(rest, p * w), n = std::min(rest - from, w);
+                std::memcpy(dst[p] + groups * w, src + groups * group + from, n);
+                std::memset(dst[p] + groups * w + n, 0, w - n);
+            }
+        }
 
-            // gathering
-            for (int i = 0; i < srcs[0].length(); i++) {
-
-                int rotate = 0;
-                blocks init(maskarray.size(), 0);
-                blocks buf(maskarray.size(), 0);
-                for (int k = 0; k < maskarray.size(); k++) {
+        static void gatherStripe(const char* const* srcs, size_t plen, size_t cnt, size_t w, char* dst) {
+            const size_t groups = plen / w;
+            if (w == 1) {
+                for (size_t g = 0; g < groups; g++) {
+                    for (size_t p = 0; p < cnt; p++) dst[g * cnt + p] = srcs[p][g];
+                }
+                return;
+            }
+            for (size_t g = 0; g < groups; g++) {
+                for (size_t p = 0; p < cnt; p++) std::memcpy(dst + (g * cnt + p) * w, srcs[p] + g * w, w);
+            }
+        }
 
-                    int idx = 0 + rotate;
-                    for (auto mask : maskarray) {
-                        buf[k] |= srcs[idx][i] & mask;
-                        if (++idx == maskarray.size()) idx = 0;
-                    }
-                    if (++rotate == maskarray.size()) rotate = 0;
+        // 8 pieces
+        //  Each group of 8 stream bytes becomes one byte of every piece, an 8x8
+        //  bit matrix per group. Transposing the bytes of 8 (or 16) groups first
+        //  puts byte r of every group in one word, after which a piece is an OR
+        //  of the 8 words under its masks, 8 or 16 groups at a time. Both start
+        //  at group g and return the groups done, the caller finishes the rest.
+        static size_t scat8(const char* src, size_t g, size_t groups, const uint8_t (&mt)[8][8], char* const* dst) {
+#ifdef DSCAT_SCATLIB_SSE2
+            __m128i m[8][8];
+            for (size_t p = 0; p < 8; p++) {
+                for (size_t r = 0; r < 8; r++) m[p][r] = _mm_set1_epi8(static_cast<char>(mt[p][r]));
+            }
+            for (; g + 16 <= groups; g += 16) {
+                __m128i rows[8], a[4], b[4], t[8];
+                for (size_t i = 0; i < 8; i++) rows[i] = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(src + g * 8 + i * 8));
+                transpose8(rows, a);
+                for (size_t i = 0; i < 8; i++) rows[i] = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(src + g * 8 + 64 + i * 8));
+                transpose8(rows, b);
+                for (size_t j = 0; j < 4; j++) {
+                    t[2 * j] = _mm_unpacklo_epi64(a[j], b[j]);
+                    t[2 * j + 1] = _mm_unpackhi_epi64(a[j], b[j]);
+                }
+                for (size_t p = 0; p < 8; p++) {
+                    __m128i v = _mm_and_si128(t[0], m[p][0]);
+                    for (size_t r = 1; r < 8; r++) v = _mm_or_si128(v, _mm_and_si128(t[r], m[p][r]));
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst[p] + g), v);
+                }
+            }
+#elif defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            uint64_t m[8][8];
+            for (size_t p = 0; p < 8; p++) {
+                for (size_t r = 0; r < 8; r++) m[p][r] = mt[p][r] * 0x0101010101010101ULL;
+            }
+            for (; g + 8 <= groups; g += 8) {
+                uint64_t t[8];
+                std::memcpy(t, src + g * 8, sizeof(t));
+                transpose8(t);
+                for (size_t p = 0; p < 8; p++) {
+                    uint64_t v = 0;
+                    for (size_t r = 0; r < 8; r++) v |= t[r] & m[p][r];
+                    std::memcpy(dst[p] + g, &v, 8);
+                }
+            }
+#endif
+            return g;
+        }
 
+        static size_t gather8(const char* const* srcs, size_t g, size_t plen, const uint8_t (&mt)[8][8], char* dst) {
+#ifdef DSCAT_SCATLIB_SSE2
+            __m128i m[8][8];
+            for (size_t k = 0; k < 8; k++) {
+                for (size_t p = 0; p < 8; p++) m[k][p] = _mm_set1_epi8(static_cast<char>(mt[k][p]));
+            }
+            for (; g + 16 <= plen; g += 16) {
+                __m128i in[8], t[8], hi[8], c[4];
+                for (size_t p = 0; p < 8; p++) in[p] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(srcs[p] + g));
+                for (size_t k = 0; k < 8; k++) {
+                    __m128i v = _mm_and_si128(in[0], m[k][0]);
+                    for (size_t p = 1; p < 8; p++) v = _mm_or_si128(v, _mm_and_si128(in[p], m[k][p]));
+                    t[k] = v;
+                    hi[k] = _mm_srli_si128(v, 8);
                 }
-                for (auto c : buf) {
-                    dest.push_back(static_cast<char>(c));
+                transpose8(t, c);
+                for (size_t j = 0; j < 4; j++) _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + g * 8 + j * 16), c[j]);
+                transpose8(hi, c);
+                for (size_t j = 0; j < 4; j++) _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + g * 8 + 64 + j * 16), c[j]);
+            }
+#elif defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            uint64_t m[8][8];
+            for (size_t k = 0; k < 8; k++) {
+                for (size_t p = 0; p < 8; p++) m[k][p] = mt[k][p] * 0x0101010101010101ULL;
+            }
+            for (; g + 8 <= plen; g += 8) {
+                uint64_t in[8], t[8];
+                for (size_t p = 0; p < 8; p++) std::memcpy(&in[p], srcs[p] + g, 8);
+                for (size_t k = 0; k < 8; k++) {
+                    uint64_t v = 0;
+                    for (size_t p = 0; p < 8; p++) v |= in[p] & m[k][p];
+                    t[k] = v;
                 }
-                buf = init;
+                transpose8(t);
+                std::memcpy(dst + g * 8, t, sizeof(t));
+            }
+#endif
+            return g;
+        }
+
+#ifdef DSCAT_SCATLIB_GFNI
+// GCC 12 takes the undefined pass-through operand of several AVX-512
+// intrinsics for a read of an uninitialized value (at -O2 -Wall)
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+        // 8 pieces with GFNI (AVX-512)
+        //  The same transposed form, 64 groups at a time: contiguous loads are
+        //  regrouped by 128-bit lanes so that every lane holds 16 consecutive
+        //  groups, the bytes are transposed within the lanes, and each piece is
+        //  the XOR of gf2p8affineqb over the 8 byte rows. The matrices are the
+        //  masks on the diagonal, any other 8x8 bit matrix would work as well.
+        //  Used only when the CPU has GFNI, AVX-512F/BW and the kernel agrees
+        //  with the generic code on a test block.
+        static bool gfni() {
+            static const bool ok = __builtin_cpu_supports("gfni") && __builtin_cpu_supports("avx512f") &&
+                                   __builtin_cpu_supports("avx512bw") && gfniCheck();
+            return ok;
+        }
 
+        // matrix of gf2p8affineqb keeping the bits of mask m in place
+        static uint64_t diagonal(uint8_t m) {
+            uint64_t a = 0;
+            for (int i = 0; i < 8; i++) {
+                if (m & (1 << i)) a |= uint64_t(1) << (8 * (7 - i) + i);
             }
+            return a;
+        }
 
-            // get metadata
-            if (destlen <= sizeof(block_meta)) return -1; // illegal file error
-            uint64_t    m_fs = reinterpret_cast<block_meta*>(&dest[0])->filesize;
-            std::string m_hash(reinterpret_cast<block_meta*>(&dest[0])->hash, 64);
+        // 4x4 transpose of the 128-bit lanes of v[0..3]
+        __attribute__((target("avx512f")))
+        static void lanes4(__m512i* v) {
+            __m512i t0 = _mm512_shuffle_i64x2(v[0], v[1], 0x44), t1 = _mm512_shuffle_i64x2(v[0], v[1], 0xee);
+            __m512i t2 = _mm512_shuffle_i64x2(v[2], v[3], 0x44), t3 = _mm512_shuffle_i64x2(v[2], v[3], 0xee);
+            v[0] = _mm512_shuffle_i64x2(t0, t2, 0x88);
+            v[1] = _mm512_shuffle_i64x2(t0, t2, 0xdd);
+            v[2] = _mm512_shuffle_i64x2(t1, t3, 0x88);
+            v[3] = _mm512_shuffle_i64x2(t1, t3, 0xdd);
+        }
 
-            // trim data
-            dest.erase(dest.begin(), dest.begin() + sizeof(block_meta));
-            dest.erase(dest.begin() + m_fs, dest.end());
+        // 8x8 transpose of the 16-bit units of every lane of v[0..7]
+        __attribute__((target("avx512f,avx512bw")))
+        static void units8(__m512i* v) {
+            __m512i a[8], b[8];
+            for (size_t i = 0; i < 4; i++) {
+                a[2 * i] = _mm512_unpacklo_epi16(v[2 * i], v[2 * i + 1]);
+                a[2 * i + 1] = _mm512_unpackhi_epi16(v[2 * i], v[2 * i + 1]);
+            }
+            for (size_t i = 0; i < 2; i++) {
+                b[4 * i] = _mm512_unpacklo_epi32(a[4 * i], a[4 * i + 2]);
+                b[4 * i + 1] = _mm512_unpackhi_epi32(a[4 * i], a[4 * i + 2]);
+                b[4 * i + 2] = _mm512_unpacklo_epi32(a[4 * i + 1], a[4 * i + 3]);
+                b[4 * i + 3] = _mm512_unpackhi_epi32(a[4 * i + 1], a[4 * i + 3]);
+            }
+            for (size_t i = 0; i < 4; i++) {
+                v[2 * i] = _mm512_unpacklo_epi64(b[i], b[i + 4]);
+                v[2 * i + 1] = _mm512_unpackhi_epi64(b[i], b[i + 4]);
+            }
+        }
 
-            // check data
-            std::string hash;
-            if (!dscat::computeHash(dest, hash)) return -1; // hashing error
-            if (hash.compare(m_hash) != 0) return -2; // hash mismatch
+        __attribute__((target("gfni,avx512f,avx512bw")))
+        static size_t scat8Gfni(const char* src, size_t groups, const uint8_t (&mt)[8][8], char* const* dst) {
+            // the two groups of a lane, byte by byte
+            const __m512i zip = _mm512_broadcast_i32x4(_mm_setr_epi8(0, 8, 1, 9, 2, 10, 3, 11, 4, 12, 5, 13, 6, 14, 7, 15));
+            __m512i m[8][8];
+            for (size_t p = 0; p < 8; p++) {
+                for (size_t r = 0; r < 8; r++) m[p][r] = _mm512_set1_epi64(static_cast<long long>(diagonal(mt[p][r])));
+            }
+            size_t g = 0;
+            for (; g + 64 <= groups; g += 64) {
+                // v[k] lane l: groups 16l+2k and 16l+2k+1
+                __m512i v[8];
+                for (size_t q = 0; q < 8; q++) v[q % 2 * 4 + q / 2] = _mm512_loadu_si512(src + g * 8 + q * 64);
+                lanes4(v);
+                lanes4(v + 4);
+                for (size_t k = 0; k < 8; k++) v[k] = _mm512_shuffle_epi8(v[k], zip);
+                units8(v); // v[r] lane l: byte r of groups 16l..16l+15
+                for (size_t p = 0; p < 8; p++) {
+                    __m512i o = _mm512_gf2p8affine_epi64_epi8(v[0], m[p][0], 0);
+                    for (size_t r = 1; r < 8; r++) o = _mm512_xor_si512(o, _mm512_gf2p8affine_epi64_epi8(v[r], m[p][r], 0));
+                    _mm512_storeu_si512(dst[p] + g, o);
+                }
+            }
+            return g;
+        }
 
-            // succeeded
-            return 0;
+        __attribute__((target("gfni,avx512f,avx512bw")))
+        static size_t gather8Gfni(const char* const* srcs, size_t plen, const uint8_t (&mt)[8][8], char* dst) {
+            const __m512i unzip = _mm512_broadcast_i32x4(_mm_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14, 1, 3, 5, 7, 9, 11, 13, 15));
+            __m512i m[8][8];
+            for (size_t k = 0; k < 8; k++) {
+                for (size_t p = 0; p < 8; p++) m[k][p] = _mm512_set1_epi64(static_cast<long long>(diagonal(mt[k][p])));
+            }
+            size_t g = 0;
+            for (; g + 64 <= plen; g += 64) {
+                __m512i in[8], v[8];
+                for (size_t p = 0; p < 8; p++) in[p] = _mm512_loadu_si512(srcs[p] + g);
+                for (size_t k = 0; k < 8; k++) {
+                    __m512i o = _mm512_gf2p8affine_epi64_epi8(in[0], m[k][0], 0);
+                    for (size_t p = 1; p < 8; p++) o = _mm512_xor_si512(o, _mm512_gf2p8affine_epi64_epi8(in[p], m[k][p], 0));
+                    v[k] = o;
+                }
+                units8(v);
+                for (size_t k = 0; k < 8; k++) v[k] = _mm512_shuffle_epi8(v[k], unzip);
+                lanes4(v);
+                lanes4(v + 4);
+                for (size_t q = 0; q < 8; q++) _mm512_storeu_si512(dst + g * 8 + q * 64, v[q % 2 * 4 + q / 2]);
+            }
+            return g;
+        }
 
+        // the GFNI kernels against the generic loops, on a block of every byte
+        // value with the default masks and with shuffled ones
+        static bool gfniCheck() {
+            std::vector<char> src(8 * 128), back(src.size());
+            for (size_t i = 0; i < src.size(); i++) src[i] = static_cast<char>(i * 131 + (i >> 8));
+            for (uint8_t step : {1, 3}) {
+                uint8_t mt[8][8], gt[8][8], ma[8];
+                for (size_t i = 0; i < 8; i++) ma[(i * step) % 8] = static_cast<uint8_t>(1 << i);
+                for (size_t p = 0; p < 8; p++) {
+                    for (size_t r = 0; r < 8; r++) mt[p][r] = gt[r][p] = ma[(p + 8 - r) % 8];
+                }
+                std::vector<std::vector<char>> pieces(8, std::vector<char>(128));
+                std::vector<char*> dst(8);
+                for (size_t p = 0; p < 8; p++) dst[p] = pieces[p].data();
+                if (scat8Gfni(src.data(), 128, mt, dst.data()) != 128) return false;
+                for (size_t g = 0; g < 128; g++) {
+                    for (size_t p = 0; p < 8; p++) {
+                        uint8_t v = 0;
+                        for (size_t r = 0; r < 8; r++) v |= static_cast<uint8_t>(src[g * 8 + r]) & mt[p][r];
+                        if (static_cast<uint8_t>(pieces[p][g]) != v) return false;
+                    }
+                }
+                std::vector<const char*> in(dst.begin(), dst.end());
+                if (gather8Gfni(in.data(), 128, gt, back.data()) != 128 || back != src) return false;
+            }
+            return true;
         }
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+#endif
+
+#ifdef DSCAT_SCATLIB_SSE2
+        // 8x8 byte transpose of the low halves of rows, c[j] holds columns 2j and 2j+1
+        static void transpose8(const __m128i* rows, __m128i* c) {
+            __m128i a0 = _mm_unpacklo_epi8(rows[0], rows[1]), a1 = _mm_unpacklo_epi8(rows[2], rows[3]);
+            __m128i a2 = _mm_unpacklo_epi8(rows[4], rows[5]), a3 = _mm_unpacklo_epi8(rows[6], rows[7]);
+            __m128i b0 = _mm_unpacklo_epi16(a0, a1), b1 = _mm_unpackhi_epi16(a0, a1);
+            __m128i b2 = _mm_unpacklo_epi16(a2, a3), b3 = _mm_unpackhi_epi16(a2, a3);
+            c[0] = _mm_unpacklo_epi32(b0, b2);
+            c[1] = _mm_unpackhi_epi32(b0, b2);
+            c[2] = _mm_unpacklo_epi32(b1, b3);
+            c[3] = _mm_unpackhi_epi32(b1, b3);
+        }
+#else
+        // 8x8 byte transpose in place (byte j of t[i] is row i, column j),
+        // swapping 4x4, 2x2 then 1x1 blocks
+        static void transpose8(uint64_t (&t)[8]) {
+            for (size_t i = 0; i < 4; i++) {
+                uint64_t x = ((t[i] >> 32) ^ t[i + 4]) & 0x00000000ffffffffULL;
+                t[i] ^= x << 32;
+                t[i + 4] ^= x;
+            }
+            for (size_t i : {0, 1, 4, 5}) {
+                uint64_t x = ((t[i] >> 16) ^ t[i + 2]) & 0x0000ffff0000ffffULL;
+                t[i] ^= x << 16;
+                t[i + 2] ^= x;
+            }
+            for (size_t i : {0, 2, 4, 6}) {
+                uint64_t x = ((t[i] >> 8) ^ t[i + 1]) & 0x00ff00ff00ff00ffULL;
+                t[i] ^= x << 8;
+                t[i + 1] ^= x;
+            }
+        }
+#endif
+
+        bool keyed = false;
+        size_t keycnt = 0;
+        uint8_t kt[8][8] = {}; // keyed mt[p][r] of scatBlock
 
     };
 
@@ -0,0 +1,197 @@
+/*
+ * Copyright (c) 2018 https://github.com/dscat/cuitool
+ *
+ * Licensed under the MIT License: http://www.opensource.org/licenses/mit-license.php
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef DSCAT_LIB_STATS_HPP
+#define DSCAT_LIB_STATS_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <time.h>
+#include <sys/resource.h>
+
+namespace dscat {
+
+    // bytes held in I/O buffers (iobuf), current and peak
+    class memory {
+
+    public:
+
+        static constexpr size_t reserve = 8 << 20; // outside of the buffers: code, stacks, rings, small allocations
+
+        static void acquire(size_t n) {
+            size_t c = counter().fetch_add(n, std::memory_order_relaxed) + n;
+            size_t p = high().load(std::memory_order_relaxed);
+            while (c > p && !high().compare_exchange_weak(p, c, std::memory_order_relaxed)) {}
+        }
+        static void release(size_t n) { counter().fetch_sub(n, std::memory_order_relaxed); }
+        static size_t current() { return counter().load(std::memory_order_relaxed); }
+        static size_t peak() { return high().load(std::memory_order_relaxed); }
+
+    private:
+
+        static std::atomic<size_t>& counter() {
+            static std::atomic<size_t> c{0};
+            return c;
+        }
+        static std::atomic<size_t>& high() {
+            static std::atomic<size_t> h{0};
+            return h;
+        }
+
+    };
+
+    class stats {
+
+    public:
+
+        typedef struct {
+            std::string name;
+            double wall = 0; // seconds
+            double cpu = 0;  // seconds (user + sys)
+            uint64_t bytes = 0;
+        } stage;
+
+        // process cpu time in seconds
+        static double cputime() {
+            struct rusage ru;
+            if (getrusage(RUSAGE_SELF, &ru) != 0) return 0;
+            return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+        }
+
+        // cpu time of the calling thread in seconds
+        static double threadCputime() {
+            timespec ts;
+            if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0) return 0;
+            return ts.tv_sec + ts.tv_nsec / 1e9;
+        }
+
+        // peak resident set size in bytes
+        static uint64_t peakRss() {
+            struct rusage ru;
+            if (getrusage(RUSAGE_SELF, &ru) != 0) return 0;
+#ifdef __APPLE__
+            return static_cast<uint64_t>(ru.ru_maxrss);        // bytes
+#else
+            return static_cast<uint64_t>(ru.ru_maxrss) * 1024; // kilobytes
+#endif
+        }
+
+        // busy time of one pipeline thread, added to a stage when it ends
+        class meter {
+            std::chrono::steady_clock::time_point wall0;
+            double cpu0 = 0;
+        public:
+            double wall = 0, cpu = 0;
+            uint64_t bytes = 0;
+            void begin() {
+                wall0 = std::chrono::steady_clock::now();
+                cpu0 = stats::threadCputime();
+            }
+            void end(uint64_t b) {
+                std::chrono::duration<double> w = std::chrono::steady_clock::now() - wall0;
+                wall += w.count();
+                cpu += stats::threadCputime() - cpu0;
+                bytes += b;
+            }
+        };
+
+        stats() : start(std::chrono::steady_clock::now()), cpustart(cputime()) {}
+
+        // accumulate into a stage, keeping the first-seen order
+        void add(const std::string& name, double wall, double cpu, uint64_t bytes) {
+            std::lock_guard<std::mutex> lk(mtx);
+            for (auto& s : stages) {
+                if (s.name == name) {
+                    s.wall += wall;
+                    s.cpu += cpu;
+                    s.bytes += bytes;
+                    return;
+                }
+            }
+            stage s;
+            s.name = name;
+            s.wall = wall;
+            s.cpu = cpu;
+            s.bytes = bytes;
+            stages.push_back(s);
+        }
+
+        void add(const std::string& name, const meter& m) { add(name, m.wall, m.cpu, m.bytes); }
+
+        const std::vector<stage>& get() const { return stages; }
+
+        static double mbps(uint64_t bytes, double wall) { return wall > 0 ? bytes / wall / 1e6 : 0; }
+
+        void report(std::ostream& os, bool json) const {
+            std::chrono::duration<double> wall = std::chrono::steady_clock::now() - start;
+            double cpu = cputime() - cpustart;
+            std::ios_base::fmtflags flags(os.flags());
+            os << std::fixed;
+            if (json) {
+                os << "{\"stages\":[";
+                for (size_t i = 0; i < stages.size(); i++) {
+                    auto& s = stages[i];
+                    os << (i ? "," : "") << "{\"name\":\"" << s.name << "\""
+                       << std::setprecision(6) << ",\"wall_s\":" << s.wall << ",\"cpu_s\":" << s.cpu
+                       << ",\"bytes\":" << s.bytes
+                       << std::setprecision(2) << ",\"mb_per_s\":" << mbps(s.bytes, s.wall) << "}";
+                }
+                os << "]" << std::setprecision(6) << ",\"wall_s\":" << wall.count() << ",\"cpu_s\":" << cpu
+                   << ",\"peak_rss_bytes\":" << peakRss() << ",\"peak_buffer_bytes\":" << memory::peak() << "}" << std::endl;
+            } else {
+                os << std::left << std::setw(12) << "stage" << std::right
+                   << std::setw(12) << "wall(s)" << std::setw(12) << "cpu(s)"
+                   << std::setw(16) << "bytes" << std::setw(12) << "MB/s" << std::endl;
+                for (auto& s : stages) {
+                    os << std::left << std::setw(12) << s.name << std::right << std::setprecision(6)
+                       << std::setw(12) << s.wall << std::setw(12) << s.cpu
+                       << std::setw(16) << s.bytes << std::setprecision(2)
+                       << std::setw(12) << mbps(s.bytes, s.wall) << std::endl;
+                }
+                os << std::left << std::setw(12) << "total" << std::right << std::setprecision(6)
+                   << std::setw(12) << wall.count() << std::setw(12) << cpu << std::endl;
+                os << "peak rss: " << peakRss() / 1024 << " KiB, buffers: " << memory::peak() / 1024 << " KiB" << std::endl;
+            }
+            os.flags(flags);
+        }
+
+    private:
+
+        std::vector<stage> stages;
+        std::mutex mtx;
+        std::chrono::steady_clock::time_point start;
+        double cpustart;
+
+    };
+
+} // ns::dscat
+
+#endif //DSCAT_LIB_STATS_HPP
@@ -0,0 +1,342 @@
+/*
+ * Copyright (c) 2018 https://github.com/dscat/cuitool
+ *
+ * Licensed under the MIT License: http://www.opensource.org/licenses/mit-license.php
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef DSCAT_LIB_STORE_HPP
+#define DSCAT_LIB_STORE_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <set>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "erasure.hpp"
+#include "hash.hpp"
+#include "incremental.hpp"
+#include "ioengine.hpp"
+#include "pipeline.hpp"
+#include "scatlib.hpp"
+#include "stats.hpp"
+
+namespace dscat {
+
+    // piece store
+    //  Every piece slot is a directory. A chunk is stored as the piece bytes
+    //  of each slot, named by their sha256 (<slot>/chunks/<2 hex>/<64 hex>),
+    //  so a chunk shared by several files is stored once per slot and a slot
+    //  tells no more than its bytes. A file is a recipe of chunks per slot
+    //  (<slot>/recipes/<name>, in the chunkindex format).
+    class store {
+
+    public:
+
+        typedef struct {
+            uint64_t filesize = 0;
+            std::string hash;
+            uint64_t chunks = 0;
+            uint64_t reused = 0;         // chunks already stored in every slot
+            uint64_t written = 0;        // piece bytes written (all slots)
+            std::vector<size_t> rebuilt; // data slots rebuilt from parity (get)
+            std::vector<size_t> broken;  // slots holding a chunk that failed its digest (get)
+        } result;
+
+        store(const std::vector<uint8_t>& ma, ioengine& io, size_t npar = 0, stats* st = nullptr)
+                : ma(ma), io(io), npar(npar), st(st), er(ma.size(), npar) {}
+
+        // a recipe name is a plain file name in the slot
+        static bool validName(const std::string& name) {
+            return !name.empty() && name != "." && name != ".." && name.find('/') == std::string::npos
+                   && name.find('\0') == std::string::npos;
+        }
+
+        // buffer bytes of put() and get(), fixed by the chunk sizes
+        size_t footprint() const {
+            return chunker::bufsize + (ma.size() + npar) * (chunker::maxsize / ma.size() + 1) + chunker::maxsize + ma.size();
+        }
+
+        // store infd as `name` in the slots (data then parity slots), nothing
+        // is written in test mode
+        //  returns 0, -1 invalid name, -2 hashing error, -4 I/O error
+        int put(int infd, const std::vector<std::string>& slots, const std::string& name, bool test, result& res) {
+            const size_t cnt = ma.size(), all = cnt + npar;
+            res = result();
+            if (!validName(name)) return -1;
+            if (slots.size() != all) return -4;
+            if (!test) {
+                for (auto& slot : slots) {
+                    if (mkdirs(slot + "/chunks") != 0 || mkdirs(slot + "/recipes") != 0) return -4;
+                }
+            }
+
+            std::vector<chunkindex> recipes(all);
+            std::vector<iobuf> bufs(all, iobuf(chunker::maxsize / cnt + 1));
+            std::vector<char*> dst(all);
+            for (size_t p = 0; p < all; p++) dst[p] = bufs[p].data();
+            std::set<std::string> dirs, seen;
+            std::string digests(32 * all, '\0');
+            stats::meter mr, mh, mk, mw;
+            hasher file, piece;
+
+            int ret = chunker::split(infd, mr, [&](const char* src, size_t len) {
+                chunkindex::entry e = {};
+                e.len = static_cast<uint32_t>(len);
+                e.plen = static_cast<uint32_t>((len + cnt - 1) / cnt);
+                mk.begin();
+                lib.scatBlock(src, len, ma, dst.data());
+                if (npar != 0) er.encode(dst.data(), dst.data() + cnt, e.plen);
+                mk.end(len);
+
+                // the file hash, and the names of the piece bytes
+                mh.begin();
+                bool ok = file.update(src, len);
+                for (size_t p = 0; p < all && ok; p++) {
+                    ok = piece.update(dst[p], e.plen) && piece.digest(reinterpret_cast<unsigned char*>(&digests[32 * p]));
+                }
+                mh.end(len + static_cast<uint64_t>(e.plen) * all);
+                if (!ok) return -2;
+                for (size_t p = 0; p < all; p++) {
+                    std::memcpy(e.digest, digests.data() + 32 * p, 32);
+                    recipes[p].list.push_back(e);
+                }
+                res.chunks++;
+                if (!seen.insert(digests).second) {
+                    res.reused++;
+                    return 0;
+                }
+                if (test) return 0;
+
+                // slots missing the chunk (or holding a short one)
+                std::vector<size_t> missing;
+                std::vector<std::string> hex(all);
+                for (size_t p = 0; p < all; p++) {
+                    struct stat sb;
+                    hex[p] = tohex(reinterpret_cast<const unsigned char*>(digests.data() + 32 * p));
+                    if (stat(path(slots[p], hex[p]).c_str(), &sb) != 0 || static_cast<uint64_t>(sb.st_size) != e.plen) {
+                        missing.push_back(p);
+                    }
+                }
+                if (missing.empty()) {
+                    res.reused++;
+                    return 0;
+                }
+
+                // write temporaries, then rename them into place
+                mw.begin();
+                std::vector<int> fds;
+                std::vector<ioengine::request> reqs;
+                std::string tmp = "." + std::to_string(getpid()) + ".tmp";
+                int r = 0;
+                for (auto p : missing) {
+                    std::string dir = slots[p] + "/chunks/" + hex[p].substr(0, 2);
+                    if (dirs.insert(dir).second && mkdirs(dir) != 0) r = -4;
+                    int fd = r == 0 ? open((path(slots[p], hex[p]) + tmp).c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644) : -1;
+                    if (fd < 0) {
+                        r = -4;
+                        break;
+                    }
+                    fds.push_back(fd);
+                    reqs.push_back(ioengine::request{fd, bufs[p].data(), e.plen, 0, true});
+                }
+                if (r == 0 && io.run(reqs) != 0) r = -4;
+                for (auto fd : fds) close(fd);
+                for (size_t i = 0; i < missing.size(); i++) {
+                    std::string to = path(slots[missing[i]], hex[missing[i]]);
+                    if (i < fds.size() && r == 0 && rename((to + tmp).c_str(), to.c_str()) != 0) r = -4;
+                    if (r != 0) unlink((to + tmp).c_str());
+                }
+                mw.end(static_cast<uint64_t>(e.plen) * missing.size());
+                res.written += static_cast<uint64_t>(e.plen) * missing.size();
+                return r;
+            });
+            if (ret != 0) return ret;
+            if (!file.final(res.hash)) return -2;
+
+            // recipes, once their chunks are in place
+            for (auto& e : recipes[0].list) res.filesize += e.len;
+            for (auto& recipe : recipes) {
+                recipe.head.count = static_cast<uint32_t>(cnt);
+                recipe.head.parity = static_cast<uint32_t>(npar);
+                recipe.head.filesize = res.filesize;
+            }
+            chunkindex::split(res.filesize, res.hash, ma, recipes);
+            if (!test) {
+                for (size_t p = 0; p < all; p++) {
+                    if (recipes[p].save(slots[p] + "/recipes/" + name) != 0) return -4;
+                }
+            }
+            if (st != nullptr) {
+                st->add("read", mr);
+                st->add("hash", mh);
+                st->add("kernel", mk);
+                st->add("write", mw);
+            }
+            return 0;
+        }
+
+        // follow the recipe `name` into outfd (no writes when outfd < 0)
+        //  A chunk read from a slot is checked against its name, one that
+        //  fails is taken from the next slot and rebuilt from parity.
+        //  returns 0, -1 missing recipe or chunks, -2 hashing error, -3 hash mismatch, -4 I/O error
+        int get(const std::vector<std::string>& slots, const std::string& name, int outfd, result& res) {
+            const size_t cnt = ma.size(), all = cnt + npar;
+            res = result();
+            if (!validName(name) || slots.size() != all) return -1;
+            std::vector<chunkindex> recipes(all);
+            std::vector<const chunkindex*> loaded(all, nullptr);
+            for (size_t p = 0; p < all; p++) {
+                if (recipes[p].load(slots[p] + "/recipes/" + name) == 0) loaded[p] = &recipes[p];
+            }
+            std::vector<pipeline::extent> segs;
+            std::string want;
+            if (chunkindex::join(loaded, ma, segs, res.filesize, want) != 0) return -1;
+
+            // the slots whose recipe has the layout of the joined ones
+            std::vector<bool> has(all, false);
+            for (size_t p = 0; p < all; p++) {
+                has[p] = loaded[p] != nullptr && recipes[p].list.size() == segs.size();
+                for (size_t i = 0; i < segs.size() && has[p]; i++) {
+                    has[p] = recipes[p].list[i].len == segs[i].len && recipes[p].list[i].plen == segs[i].plen;
+                }
+            }
+
+            std::vector<iobuf> bufs(all, iobuf(chunker::maxsize / cnt + 1));
+            std::vector<char*> src(all);
+            for (size_t p = 0; p < all; p++) src[p] = bufs[p].data();
+            iobuf out(chunker::maxsize + cnt);
+            std::vector<size_t> prepared;
+            std::set<size_t> rebuilt, broken;
+            stats::meter mr, mh, mk, mw;
+            hasher h, piece;
+            unsigned char d[32];
+            for (size_t i = 0; i < segs.size(); i++) {
+                const uint32_t plen = static_cast<uint32_t>(segs[i].plen), len = static_cast<uint32_t>(segs[i].len);
+                if (plen > chunker::maxsize / cnt + 1 || len > static_cast<uint64_t>(plen) * cnt) return -1;
+
+                // the first slots holding an intact chunk
+                std::vector<size_t> use;
+                for (size_t next = 0; use.size() < cnt && next < all; ) {
+                    mr.begin();
+                    std::vector<size_t> got;
+                    std::vector<int> fds;
+                    std::vector<ioengine::request> reqs;
+                    for (; next < all && use.size() + got.size() < cnt; next++) {
+                        if (!has[next]) continue;
+                        int fd = open(path(slots[next], tohex(recipes[next].list[i].digest)).c_str(), O_RDONLY);
+                        struct stat sb;
+                        if (fd < 0) continue;
+                        if (fstat(fd, &sb) != 0 || static_cast<uint64_t>(sb.st_size) != plen) {
+                            close(fd);
+                            continue;
+                        }
+                        got.push_back(next);
+                        fds.push_back(fd);
+                        reqs.push_back(ioengine::request{fd, bufs[next].data(), plen, 0, false});
+                    }
+                    int r = reqs.empty() ? 0 : io.run(reqs);
+                    for (auto fd : fds) close(fd);
+                    mr.end(static_cast<uint64_t>(plen) * got.size());
+                    if (r != 0) return -1;
+
+                    mh.begin();
+                    for (auto p : got) {
+                        if (!piece.update(bufs[p].data(), plen) || !piece.digest(d)) return -2;
+                        if (std::memcmp(d, recipes[p].list[i].digest, 32) == 0) use.push_back(p);
+                        else broken.insert(p);
+                    }
+                    mh.end(static_cast<uint64_t>(plen) * got.size());
+                }
+                if (use.size() < cnt) return -1;
+
+                mk.begin();
+                if (use != prepared) {
+                    if (er.prepare(use) != 0) return -1;
+                    prepared = use;
+                }
+                er.rebuild(src.data(), plen);
+                for (auto p : er.missing()) rebuilt.insert(p);
+                lib.gatherBlock(src.data(), plen, ma, out.data());
+                mk.end(len);
+
+                mh.begin();
+                if (!h.update(out.data(), len)) return -2;
+                mh.end(len);
+                if (outfd >= 0) {
+                    mw.begin();
+                    if (pipeline::writeAll(outfd, out.data(), len) != 0) return -4;
+                    mw.end(len);
+                }
+            }
+            res.rebuilt.assign(rebuilt.begin(), rebuilt.end());
+            res.broken.assign(broken.begin(), broken.end());
+            if (!h.final(res.hash)) return -2;
+            if (st != nullptr) {
+                st->add("read", mr);
+                st->add("kernel", mk);
+                st->add("hash", mh);
+                st->add("write", mw);
+            }
+            return res.hash != want ? -3 : 0;
+        }
+
+    private:
+
+        static std::string tohex(const unsigned char* d) {
+            static const char* x = "0123456789abcdef";
+            std::string s(64, '0');
+            for (int i = 0; i < 32; i++) {
+                s[2 * i] = x[d[i] >> 4];
+                s[2 * i + 1] = x[d[i] & 15];
+            }
+            return s;
+        }
+
+        static std::string path(const std::string& slot, const std::string& hex) {
+            return slot + "/chunks/" + hex.substr(0, 2) + "/" + hex;
+        }
+
+        // mkdir -p
+        static int mkdirs(const std::string& dir) {
+            for (size_t i = 1; i <= dir.size(); i++) {
+                if (i != dir.size() && dir[i] != '/') continue;
+                if (mkdir(dir.substr(0, i).c_str(), 0755) != 0 && errno != EEXIST) return -1;
+            }
+            return 0;
+        }
+
+        std::vector<uint8_t> ma;
+        ioengine& io;
+        size_t npar;
+        stats* st;
+        erasure er;
+        scatlib lib;
+
+    };
+
+} // ns::dscat
+
+#endif //DSCAT_LIB_STORE_HPP
@@ -0,0 +1,142 @@
+/*
+ * Copyright (c) 2018 https://github.com/dscat/cuitool
+ *
+ * Licensed under the MIT License: http://www.opensource.org/licenses/mit-license.php
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef DSCAT_LIB_VERIFY_HPP
+#define DSCAT_LIB_VERIFY_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include "executor.hpp"
+#include "ioengine.hpp"
+#include "pipeline.hpp"
+#include "stats.hpp"
+
+namespace dscat {
+
+    // verifier
+    //  Checks piece sets without any output. Every set streams through the
+    //  gather pipeline (rebuild, gather, decode, hash) and the data hash is
+    //  compared, so a set costs the chunk pool of one pipeline whatever its
+    //  size. Pieces with tails are also checked against their digests and a
+    //  bad one, or one of another scatter, is named; such a set fails even
+    //  when parity restores the data. Sets are verified concurrently, each
+    //  with its own ioengine, and spread over the NUMA nodes of the executor.
+    class verifier {
+
+    public:
+
+        typedef struct {
+            int ret = 0;                 // of pipeline::gather
+            uint64_t filesize = 0;
+            std::vector<size_t> missing; // pieces that could not be opened
+            std::vector<size_t> broken;  // pieces that failed their digest
+            std::vector<size_t> rebuilt; // data pieces rebuilt from parity
+        } report;
+
+        verifier(const std::vector<uint8_t>& ma, ioengine& io, executor& ex, stats* st = nullptr)
+                : ma(ma), io(io), ex(ex), st(st) {}
+
+        void parity(size_t m) { npar = m; }
+
+        // buffer budget of all sets in flight together (0 is no limit)
+        void maxMemory(size_t bytes) { budget = bytes; }
+
+        // sets verified at the same time (0: a set per worker)
+        void jobs(unsigned n) { njobs = n; }
+
+        // key of keyed masks, for sets gathered without tails
+        void key(const std::string& k) { secret = k; }
+
+        // verify the sets (data pieces then parity pieces each), `done(i, r)` is
+        // called once set i is finished, from the thread that verified it
+        //  returns the number of failed sets
+        template <typename D> size_t run(const std::vector<std::vector<std::string>>& sets, std::vector<report>& out, D done) {
+            out.assign(sets.size(), report());
+            if (sets.empty()) return 0;
+            unsigned n = njobs != 0 ? njobs : ex.threads();
+            n = std::max(1u, std::min<unsigned>(n, static_cast<unsigned>(sets.size())));
+            std::atomic<size_t> next{0}, failed{0};
+            executor::group g(ex);
+            for (unsigned j = 0; j < n; j++) {
+                g.start([&, j]() {
+                    ioengine jio(io.type());
+                    jio.use(ex);
+                    pipeline pl(ma, jio, ex, st);
+                    pl.place(j % ex.nodes());
+                    pl.maxThreads(std::max(1u, ex.threads(j % ex.nodes()) / n));
+                    pl.parity(npar);
+                    pl.maxMemory(budget / n);
+                    int kr = pl.key(secret);
+                    for (size_t i; (i = next++) < sets.size(); ) {
+                        if (kr != 0) out[i].ret = -2;
+                        else verify(pl, sets[i], out[i]);
+                        if (out[i].ret != 0) failed++;
+                        done(i, out[i]);
+                    }
+                });
+            }
+            g.wait();
+            return failed;
+        }
+
+    private:
+
+        void verify(pipeline& pl, const std::vector<std::string>& paths, report& r) {
+            std::vector<int> fds;
+            for (size_t k = 0; k < paths.size(); k++) {
+                int fd = open(paths[k].c_str(), O_RDONLY);
+                if (fd < 0) r.missing.push_back(k);
+                fds.push_back(fd);
+            }
+            pipeline::result res;
+            r.ret = r.missing.size() > npar ? -1 : pl.gather(fds, -1, res);
+            if (r.ret == 0 && res.tagged) pl.validate(fds, res.broken); // the pieces not read
+            if (r.ret == 0 && res.tagged && !r.missing.empty()) r.ret = -1;
+            if (r.ret == 0 && !res.broken.empty()) r.ret = -1;
+            r.filesize = res.filesize;
+            r.broken = res.broken;
+            r.rebuilt = res.rebuilt;
+            for (auto fd : fds) if (fd >= 0) close(fd);
+        }
+
+        std::vector<uint8_t> ma;
+        ioengine& io;
+        executor& ex;
+        stats* st;
+        size_t npar = 0;
+        size_t budget = 0;
+        unsigned njobs = 0;
+        std::string secret;
+
+    };
+
+} // ns::dscat
+
+#endif //DSCAT_LIB_VERIFY_HPP
@@ -23,6 +23,7 @@
  *
  */
 
+#include <cstdlib>
 #include <iostream>
 #include <vector>
 #include <algorithm>
@@ -31,28 +32,67 @@
 #include <string>
 #include <sstream>
 #include <fstream>
+#include <thread>
+#include <mutex>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include "lib/clipp.h"
 #include "lib/scatlib.hpp"
-#include "lib/base64.hpp"
 #include "lib/cuilog.hpp"
 #include "lib/hash.hpp"
+#include "lib/stats.hpp"
+#include "lib/executor.hpp"
+#include "lib/ioengine.hpp"
+#include "lib/pipeline.hpp"
+#include "lib/compress.hpp"
+#include "lib/erasure.hpp"
+#include "lib/incremental.hpp"
+#include "lib/store.hpp"
+#include "lib/verify.hpp"
 
 int main(int argc, char* argv[]) {
 
     // argv parse
-    bool opt_scat = false, opt_gath = false, opt_cin = false, opt_verbose = false, opt_test = false;
-    std::string opt_pieces = "", opt_output = "";
-    int opt_piececnt = 0;
+    bool opt_scat = false, opt_gath = false, opt_verify = false, opt_info = false, opt_cin = false, opt_verbose = false, opt_test = false;
+    bool opt_stats = false, opt_statsjson = false, opt_logjson = false, opt_direct = false, opt_incremental = false,
+         opt_hugepages = false, opt_affinity = false, opt_numa = false;
+    std::string opt_pieces = "", opt_output = "", opt_logfile = "", opt_loglevel = "note", opt_io = "auto",
+                opt_compress = "", opt_store = "", opt_maxmemory = "", opt_interleave = "bit", opt_key = "";
+    int opt_piececnt = 0, opt_parity = 0, opt_threads = 0, opt_jobs = 0;
+    std::vector<std::string> opt_sets;
     auto cli = (
             (clipp::option("-s", "--scatting").set(opt_scat) |
-             clipp::option("-g", "--gathering").set(opt_gath)) % "mode",
-                    clipp::option("-c", "--count") & clipp::value("pieces", opt_piececnt) % "for scatting, count of pieces(1-8).",
+             clipp::option("-g", "--gathering").set(opt_gath) |
+             clipp::option("--verify").set(opt_verify) |
+             clipp::option("--info").set(opt_info)) % "mode",
+                    clipp::option("-c", "--count") & clipp::value("pieces", opt_piececnt) % "for scatting, count of pieces(1-8) (--info reads it from the pieces).",
+                    clipp::option("-r", "--parity") & clipp::value("parity", opt_parity) % "count of parity pieces(0-8) following the pieces, any <pieces> of all rebuild the file.",
                     clipp::option("-p", "--pieces") & clipp::value("pieces files", opt_pieces) % ("pieces file(s) comma split."),
+                    clipp::opt_values("more pieces files", opt_sets) % "for --verify and --info, more sets of pieces file(s), comma split.",
+                    clipp::option("--jobs") & clipp::value("jobs", opt_jobs) % "for --verify, sets verified at the same time (default: a set per worker).",
                     clipp::option("-i", "--stdin").set(opt_cin, true).doc("input from stdin for -s."),
                     clipp::option("-o", "--output") & clipp::value("output file", opt_output) % "file name for -g.",
                     clipp::option("-v", "--verbose").set(opt_verbose).doc("verbose mode."),
-                    clipp::option("-t", "--test").set(opt_test).doc("test mode (no output results).")
+                    clipp::option("--log-file") & clipp::value("log file", opt_logfile) % "append log lines to the file.",
+                    clipp::option("--log-level") & clipp::value("level", opt_loglevel) % "minimum level to log (note, info, warn, crit).",
+                    clipp::option("--log-json").set(opt_logjson).doc("log as JSON lines."),
+                    clipp::option("-t", "--test").set(opt_test).doc("test mode (no output results)."),
+                    clipp::option("--io") & clipp::value("engine", opt_io) % "pieces I/O engine (auto, uring, threads).",
+                    clipp::option("--compress") & clipp::value("codec", opt_compress) % "for scatting, compress before scattering (lz4, zstd).",
+                    clipp::option("--interleave") & clipp::value("grain", opt_interleave) % "for scatting, split by bit (default), nibble, byte, or blocks of <n> bytes (K suffix, a power of 2 up to 4K); gathering reads it from the pieces.",
+                    clipp::option("--key") & clipp::value("key file", opt_key) % "scramble the bit or nibble interleave with a schedule drawn from the file's bytes; gathering needs the same file.",
+                    clipp::option("--incremental").set(opt_incremental).doc("scatter/gather with a chunk index next to the pieces, re-scatting writes only changed chunks."),
+                    clipp::option("--store") & clipp::value("name", opt_store) % "pieces are store directories, keep the file as <name> there (chunks are shared between files).",
+                    clipp::option("--max-memory") & clipp::value("size", opt_maxmemory) % "keep buffers within the size (K, M or G suffix), by smaller chunks and fewer threads.",
+                    clipp::option("--direct").set(opt_direct).doc("direct I/O for pieces and output (bypass the page cache)."),
+                    clipp::option("--huge-pages").set(opt_hugepages).doc("buffers on huge pages when available."),
+                    clipp::option("--threads") & clipp::value("threads", opt_threads) % "worker threads (default: CPUs allowed by the affinity mask and the cgroup quota).",
+                    clipp::option("--affinity").set(opt_affinity).doc("pin each worker to a CPU."),
+                    clipp::option("--numa").set(opt_numa).doc("keep workers and their buffers on one NUMA node."),
+                    clipp::option("--stats").set(opt_stats).doc("print per-stage timing and throughput to stderr."),
+                    clipp::option("--stats-json").set(opt_statsjson).doc("same as --stats, in JSON.")
     );
     if (!clipp::parse(argc, argv, cli)) {
         std::cout << clipp::make_man_page(cli, argv[0]) << std::endl;
@@ -64,40 +104,170 @@ int main(int argc, char* argv[]) {
     while (std::getline(sspieces, buf, ',')) {
         if (buf != "") pieces.push_back(buf);
     }
-    if (opt_scat == opt_gath || pieces.size() != opt_piececnt
-        || (opt_scat && (opt_piececnt < 1 || 8 < opt_piececnt))) {
+    // --info takes the counts from the piece tails when they are not given
+    if (opt_info && opt_piececnt == 0) {
+        for (auto& pf : pieces) {
+            int fd = open(pf.c_str(), O_RDONLY);
+            if (fd < 0) continue;
+            dscat::scatlib::piece_tail t;
+            dscat::scatlib::piece_set set;
+            uint64_t size = 0;
+            int r = dscat::pipeline::readTail(fd, t, set, size);
+            close(fd);
+            if (r != 0) continue;
+            opt_piececnt = static_cast<int>(t.count);
+            opt_parity = static_cast<int>(t.parity);
+            break;
+        }
+    }
+
+    // --verify and --info check every set the same way
+    std::vector<std::vector<std::string>> sets(1, pieces);
+    for (auto& list : opt_sets) {
+        std::vector<std::string> set;
+        std::istringstream ssset(list);
+        while (std::getline(ssset, buf, ',')) {
+            if (buf != "") set.push_back(buf);
+        }
+        sets.push_back(set);
+    }
+    bool setsize = true;
+    for (auto& set : sets) setsize = setsize && set.size() == static_cast<size_t>(opt_piececnt + opt_parity);
+    if (opt_scat + opt_gath + opt_verify + opt_info != 1 || !setsize || (opt_sets.size() != 0 && !opt_verify && !opt_info)
+        || opt_jobs < 0
+        || (opt_scat && (opt_piececnt < 1 || 8 < opt_piececnt))
+        || opt_parity < 0 || static_cast<size_t>(opt_parity) > dscat::erasure::maxparity) {
+        std::cout << clipp::make_man_page(cli, argv[0]) << std::endl;
+        exit(1);
+    }
+
+    dscat::ioengine::backend iob = dscat::ioengine::AUTO;
+    if (opt_io == "uring") iob = dscat::ioengine::URING;
+    else if (opt_io == "threads") iob = dscat::ioengine::THREADS;
+    else if (opt_io != "auto") {
+        std::cout << clipp::make_man_page(cli, argv[0]) << std::endl;
+        exit(1);
+    }
+    dscat::codec::kind codec = dscat::codec::STORED;
+    if (opt_compress.size() != 0 && dscat::codec::parse(opt_compress, codec) != 0) {
+        std::cerr << "codec " << opt_compress << " is not available" << std::endl;
+        exit(1);
+    }
+    if ((opt_incremental || opt_store.size() != 0) && codec != dscat::codec::STORED) {
+        std::cerr << "--incremental and --store do not support --compress" << std::endl;
+        exit(1);
+    }
+    dscat::scatlib::grain grain = dscat::scatlib::GRAIN_BIT;
+    size_t width = 1;
+    if (opt_interleave == "nibble") grain = dscat::scatlib::GRAIN_NIBBLE;
+    else if (opt_interleave == "byte") grain = dscat::scatlib::GRAIN_BYTE;
+    else if (opt_interleave != "bit") {
+        char* unit = nullptr;
+        unsigned long long v = std::strtoull(opt_interleave.c_str(), &unit, 10);
+        std::string u(unit);
+        int shift = u == "" ? 0 : (u == "K" || u == "k") ? 10 : -1;
+        width = static_cast<size_t>(v) << (shift < 0 ? 0 : shift);
+        grain = dscat::scatlib::GRAIN_BLOCK;
+        if (shift < 0 || width == 0 || width > dscat::scatlib::maxwidth || (width & (width - 1)) != 0) {
+            std::cout << clipp::make_man_page(cli, argv[0]) << std::endl;
+            exit(1);
+        }
+    }
+    if ((opt_incremental || opt_store.size() != 0) && grain != dscat::scatlib::GRAIN_BIT) {
+        std::cerr << "--incremental and --store do not support --interleave" << std::endl;
+        exit(1);
+    }
+    std::string key;
+    if (opt_key.size() != 0) {
+        std::ifstream kf(opt_key, std::ios::binary);
+        key.assign(std::istreambuf_iterator<char>(kf), std::istreambuf_iterator<char>());
+        if (!kf.good() && !kf.eof()) key.clear();
+        if (key.empty()) {
+            std::cerr << "key file " << opt_key << " is empty or unreadable" << std::endl;
+            exit(1);
+        }
+        if (opt_incremental || opt_store.size() != 0) {
+            std::cerr << "--incremental and --store do not support --key" << std::endl;
+            exit(1);
+        }
+        if (grain != dscat::scatlib::GRAIN_BIT && grain != dscat::scatlib::GRAIN_NIBBLE) {
+            std::cerr << "--key needs the bit or nibble interleave" << std::endl;
+            exit(1);
+        }
+    }
+    size_t maxmemory = 0;
+    if (opt_maxmemory.size() != 0) {
+        char* unit = nullptr;
+        unsigned long long v = std::strtoull(opt_maxmemory.c_str(), &unit, 10);
+        std::string u(unit);
+        int shift = u == "" ? 0 : (u == "K" || u == "k") ? 10 : (u == "M" || u == "m") ? 20 : (u == "G" || u == "g") ? 30 : -1;
+        if (v == 0 || shift < 0) {
+            std::cout << clipp::make_man_page(cli, argv[0]) << std::endl;
+            exit(1);
+        }
+        maxmemory = static_cast<size_t>(v) << shift;
+    }
+    if (opt_threads < 0) {
         std::cout << clipp::make_man_page(cli, argv[0]) << std::endl;
         exit(1);
     }
+    if ((opt_verify || opt_info) && (opt_incremental || opt_store.size() != 0)) {
+        std::cerr << "--verify and --info do not support --incremental and --store" << std::endl;
+        exit(1);
+    }
+    if (opt_store.size() != 0 && !dscat::store::validName(opt_store)) {
+        std::cerr << "--store needs a plain name (no '/', not '.' or '..')" << std::endl;
+        exit(1);
+    }
+    if (opt_incremental && opt_store.size() != 0) {
+        std::cerr << "--incremental and --store are exclusive" << std::endl;
+        exit(1);
+    }
 
     // switch logging
+    const std::vector<std::string> levels = {"note", "info", "warn", "crit"};
+    auto lv = std::find(levels.begin(), levels.end(), opt_loglevel);
+    if (lv == levels.end()) {
+        std::cout << clipp::make_man_page(cli, argv[0]) << std::endl;
+        exit(1);
+    }
+    cuilog::logger::get().threshold(static_cast<cuilog::level>(lv - levels.begin()));
+    cuilog::logger::get().json(opt_logjson);
     opt_verbose ? cuilog::cout.enable() : cuilog::cout.disable();
+    if (opt_logfile.size() != 0 && cuilog::cout.logfile(opt_logfile) != 0) {
+        std::cerr << "could not open " << opt_logfile << std::endl;
+        exit(1);
+    }
 
     // banner
     cuilog::cout << cuilog::info("🐈 scatter v1.0") << std::endl;
     cuilog::cout << cuilog::info("Copytight (c) 2018 https://github.com/dscat/cuitool") << std::endl;
-    cuilog::cout << cuilog::note("Starting ") << (opt_scat ? "scatting" : "gathering") << " mode with " << pieces.size()
-                 << " pieces." << std::endl;
+    cuilog::cout << cuilog::note("Starting ") << (opt_scat ? "scatting" : opt_gath ? "gathering" : opt_verify ? "verifying" : "inspecting") << " mode with "
+                 << pieces.size() << " pieces." << std::endl;
     if (opt_scat && opt_cin) cuilog::cout << cuilog::note("from stdin.") << std::endl;
     if (opt_scat && !opt_cin) cuilog::cout << cuilog::note("from ") << pieces.size() << " files." << std::endl;
 
-    // read cin and calculate hash
-    std::vector<char> data;
-    std::string vhash;
-    if (opt_cin) {
-        // read
-        std::cin >> std::noskipws;
-        std::copy(std::istream_iterator<char>(std::cin), std::istream_iterator<char>(), std::back_inserter(data));
-        cuilog::cout << cuilog::note("cin - size   : ") << data.size() << " byte(s)." << std::endl;
-
-        // hash
-        dscat::computeHash(data, vhash);
-        cuilog::cout << cuilog::note("cin - sha256 : ") << vhash << std::endl;
-    }
-
-
     // main
+    dscat::stats st;
     auto scatlib = dscat::scatlib();
+    dscat::executor ex(static_cast<unsigned>(opt_threads), opt_affinity, opt_numa);
+    dscat::ioengine io(iob);
+    io.use(ex);
+    cuilog::cout << cuilog::note("I/O engine : ") << io.name() << std::endl;
+    cuilog::cout << cuilog::note("workers    : ") << ex.threads() << (opt_affinity ? " (pinned)" : "");
+    if (opt_numa) cuilog::cout << ", per NUMA node, " << ex.nodes() << " node(s)";
+    cuilog::cout << "." << std::endl;
+
+    // stats, on every return from here on (a failed run included)
+    struct reporter {
+        const dscat::stats& st;
+        bool on, json;
+        ~reporter() {
+            cuilog::flush();
+            if (on) st.report(std::cerr, json);
+        }
+    } rep{st, opt_stats || opt_statsjson, opt_statsjson};
+
     if (opt_scat) {
 
         // make masks
@@ -108,34 +278,132 @@ int main(int argc, char* argv[]) {
             return 1;
         }
 
-        // scatting
-        std::vector<std::string> output(opt_piececnt);
-        ret = scatlib.scatString(data, ma, output);
-        if (ret != 0) {
-            cuilog::cout << cuilog::crit("Error has occurred - could not make pieces.") << std::endl;
-            return 1;
+        // open pieces
+        std::vector<int> fds;
+        if (!opt_test && opt_store.size() == 0) {
+            for (auto& pf : pieces) {
+                cuilog::cout << cuilog::note("Writing ") << pf << "..." << std::endl;
+                int fd = open(pf.c_str(), O_WRONLY | O_CREAT | (opt_incremental ? 0 : O_TRUNC), 0644);
+                if (fd < 0) {
+                    cuilog::cout << cuilog::crit("Error has occurred - could not open ") << pf << "." << std::endl;
+                    return 1;
+                }
+                if (!opt_incremental) unlink((pf + ".idx").c_str()); // the pieces are rewritten
+                fds.push_back(fd);
+            }
         }
 
-        // output
-        int i = 1;
-        for (auto p : output) {
-            std::string b64, hash;
-            ret = dscat::base64_encode(p, b64);
-            ret = dscat::computeHash(p, hash);
-            cuilog::cout << cuilog::note("Scatted #") << i++ << " : " << hash << std::endl;
-            if (!opt_test) {
-                if (pieces.size() == 0) std::cout << b64 << std::endl;
-                else {
-                    cuilog::cout << cuilog::note("Writing ") << pieces[i - 2] << "..." << std::endl;
-                    std::ofstream ofile(pieces[i - 2]);
-                    ofile << p;
-                    ofile.close();
-                }
-            } else {
-                cuilog::cout << cuilog::warn("Testing mode. No outputs.") << std::endl;
+        if (opt_store.size() != 0) {
+
+            // store the chunks which are not there yet and the recipe
+            dscat::store sto(ma, io, opt_parity, &st);
+            dscat::store::result res;
+            if (maxmemory != 0 && sto.footprint() + dscat::memory::reserve > maxmemory) ret = -5;
+            else ret = sto.put(opt_cin ? STDIN_FILENO : -1, pieces, opt_store, opt_test, res);
+            if (ret == -5) {
+                cuilog::cout << cuilog::crit("Error has occurred - memory budget is too small or memory is short.") << std::endl;
+                return 1;
+            }
+            if (ret == -2) {
+                cuilog::cout << cuilog::crit("Error has occurred - hashing failed.") << std::endl;
+                return 1;
+            }
+            if (ret != 0) {
+                cuilog::cout << cuilog::crit("Error has occurred - could not write pieces.") << std::endl;
+                return 1;
+            }
+            cuilog::cout << cuilog::note("cin - size   : ") << res.filesize << " byte(s)." << std::endl;
+            cuilog::cout << cuilog::note("cin - sha256 : ") << res.hash << std::endl;
+            cuilog::cout << cuilog::note("chunks       : ") << res.chunks << ", " << res.reused << " already stored, "
+                         << res.written << " byte(s) written." << std::endl;
+            if (opt_test) cuilog::cout << cuilog::warn("Testing mode. No outputs.") << std::endl;
+            cuilog::cout << cuilog::info("🐈 completed!") << std::endl;
+
+        } else if (opt_incremental) {
+
+            // incremental scatting (only changed chunks are scattered and written)
+            dscat::incremental inc(ma, io, opt_parity, &st);
+            dscat::incremental::result res;
+            inc.maxMemory(maxmemory);
+            ret = inc.scatter(opt_cin ? STDIN_FILENO : -1, fds, pieces, res);
+            for (auto fd : fds) close(fd);
+            if (ret == -5) {
+                cuilog::cout << cuilog::crit("Error has occurred - memory budget is too small or memory is short.") << std::endl;
+                return 1;
             }
+            if (ret == -2) {
+                cuilog::cout << cuilog::crit("Error has occurred - hashing failed.") << std::endl;
+                return 1;
+            }
+            if (ret != 0) {
+                cuilog::cout << cuilog::crit("Error has occurred - could not write pieces.") << std::endl;
+                return 1;
+            }
+            if (res.compacted) cuilog::cout << cuilog::note("Mostly dead chunks in the pieces, scatting all chunks anew.") << std::endl;
+            else if (res.fresh) cuilog::cout << cuilog::note("No chunk index, scatting all chunks.") << std::endl;
+            cuilog::cout << cuilog::note("cin - size   : ") << res.filesize << " byte(s)." << std::endl;
+            cuilog::cout << cuilog::note("cin - sha256 : ") << res.hash << std::endl;
+            cuilog::cout << cuilog::note("chunks       : ") << res.chunks << ", " << res.reused << " unchanged, "
+                         << res.written << " byte(s) written." << std::endl;
+            if (opt_test) cuilog::cout << cuilog::warn("Testing mode. No outputs.") << std::endl;
+            cuilog::cout << cuilog::info("🐈 completed!") << std::endl;
+
+        } else {
+
+            // scatting (read, scatter and write run concurrently)
+            dscat::pipeline pl(ma, io, ex, &st);
+            pl.directIO(opt_direct);
+            pl.hugePages(opt_hugepages);
+            pl.compression(codec);
+            pl.parity(opt_parity);
+            pl.maxMemory(maxmemory);
+            if (pl.interleave(grain, width) != 0 || pl.key(key) != 0) {
+                cuilog::cout << cuilog::crit("Error has occurred - could not make masks.") << std::endl;
+                return 1;
+            }
+            if (grain != dscat::scatlib::GRAIN_BIT) {
+                cuilog::cout << cuilog::note("interleave   : ") << opt_interleave << "." << std::endl;
+            }
+            if (key.size() != 0) {
+                cuilog::cout << cuilog::note("key          : ") << opt_key << "." << std::endl;
+            }
+            dscat::pipeline::result res;
+            ret = pl.scatter(opt_cin ? STDIN_FILENO : -1, fds, cuilog::cout.enabled(), res);
+            for (auto fd : fds) close(fd);
+            if (ret == -5) {
+                cuilog::cout << cuilog::crit("Error has occurred - memory budget is too small or memory is short.") << std::endl;
+                return 1;
+            }
+            if (ret == -2) {
+                cuilog::cout << cuilog::crit("Error has occurred - hashing failed.") << std::endl;
+                return 1;
+            }
+            if (ret != 0) {
+                cuilog::cout << cuilog::crit("Error has occurred - could not write pieces.") << std::endl;
+                return 1;
+            }
+            if (maxmemory != 0) {
+                cuilog::cout << cuilog::note("memory       : ") << pl.chunkSize() / 1024 << " KiB chunks per piece, "
+                             << pl.threads() << " worker(s)." << std::endl;
+            }
+            if (opt_direct && !opt_test && !res.direct) {
+                cuilog::cout << cuilog::warn("Direct I/O is not supported here, used the page cache.") << std::endl;
+            }
+            cuilog::cout << cuilog::note("cin - size   : ") << res.filesize << " byte(s)." << std::endl;
+            cuilog::cout << cuilog::note("cin - sha256 : ") << res.hash << std::endl;
+            if (codec != dscat::codec::STORED) {
+                cuilog::cout << cuilog::note("compressed   : ") << dscat::codec::name(codec) << ", " << res.piecesize * ma.size()
+                             << " byte(s) in pieces." << std::endl;
+            }
+
+            // output
+            for (size_t i = 0; i < res.hashes.size(); i++) {
+                cuilog::cout << cuilog::note("Scatted #") << i + 1 << " : " << res.hashes[i] << std::endl;
+                if (opt_test) cuilog::cout << cuilog::warn("Testing mode. No outputs.") << std::endl;
+            }
+            cuilog::cout << cuilog::info("🐈 completed!") << std::endl;
+
         }
-        cuilog::cout << cuilog::info("🐈 completed!") << std::endl;
 
     } else if (opt_gath) {
 
@@ -147,21 +415,109 @@ int main(int argc, char* argv[]) {
             return 1;
         }
 
-        // gathering
-        std::vector<std::string> seps;
-        for (auto sf : pieces) {
-            std::ifstream ifs(sf);
-            std::string ibuf((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
-            seps.push_back(ibuf);
-            cuilog::cout << cuilog::note("Loaded #") << seps.size() << " from " << sf << ". ( " << ibuf.size()
-                         << " byte(s). )" << std::endl;
+        // open pieces
+        std::vector<int> fds;
+        if (opt_store.size() == 0) {
+            for (size_t k = 0; k < pieces.size(); k++) {
+                int fd = open(pieces[k].c_str(), O_RDONLY);
+                struct stat sb;
+                if ((fd < 0 || fstat(fd, &sb) != 0) && opt_parity != 0) {
+                    cuilog::cout << cuilog::warn("Missing #") << k + 1 << " " << pieces[k] << "." << std::endl;
+                    if (fd >= 0) close(fd);
+                    fds.push_back(-1);
+                    continue;
+                }
+                if (fd < 0 || fstat(fd, &sb) != 0) {
+                    cuilog::cout << cuilog::crit("Error has occurred - could not read pieces.") << std::endl;
+                    return 1;
+                }
+                fds.push_back(fd);
+                cuilog::cout << cuilog::note("Loaded #") << k + 1 << " from " << pieces[k] << ". ( " << sb.st_size
+                             << " byte(s). )" << std::endl;
+            }
+        }
+
+        // output
+        int outfd = -1;
+        if (!opt_test) {
+            if (opt_output.size() != 0) {
+                cuilog::cout << cuilog::note("Writing ") << opt_output << "..." << std::endl;
+                outfd = open(opt_output.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+                if (outfd < 0) {
+                    cuilog::cout << cuilog::crit("Error has occurred - could not open ") << opt_output << "." << std::endl;
+                    return 1;
+                }
+            } else {
+                cuilog::flush();
+                outfd = STDOUT_FILENO;
+            }
+        } else {
+            cuilog::cout << cuilog::warn("Testing mode. No outputs.") << std::endl;
+        }
+
+        dscat::pipeline::result res;
+        if (opt_store.size() != 0) {
+
+            // follow the recipe through the store
+            dscat::store sto(ma, io, opt_parity, &st);
+            dscat::store::result sr;
+            if (maxmemory != 0 && sto.footprint() + dscat::memory::reserve > maxmemory) ret = -5;
+            else ret = sto.get(pieces, opt_store, outfd, sr);
+            res.filesize = sr.filesize;
+            res.rebuilt = sr.rebuilt;
+            res.broken = sr.broken;
+
+        } else {
+
+            // gathering (read, gather, verify and write run concurrently)
+            dscat::pipeline pl(ma, io, ex, &st);
+            pl.directIO(opt_direct);
+            pl.hugePages(opt_hugepages);
+            pl.parity(opt_parity);
+            if (opt_incremental) {
+                // segments, size and hash from the chunk indexes next to the readable pieces
+                std::vector<dscat::chunkindex> idx(pieces.size());
+                std::vector<const dscat::chunkindex*> use(pieces.size(), nullptr);
+                for (size_t k = 0; k < pieces.size(); k++) {
+                    if (fds[k] >= 0 && idx[k].load(pieces[k] + ".idx") == 0) use[k] = &idx[k];
+                }
+                std::vector<dscat::pipeline::extent> segs;
+                uint64_t filesize = 0;
+                std::string hash;
+                if (dscat::chunkindex::join(use, ma, segs, filesize, hash) != 0) {
+                    cuilog::cout << cuilog::crit("Error has occurred - could not read the chunk index.") << std::endl;
+                    if (outfd >= 0 && outfd != STDOUT_FILENO) {
+                        close(outfd);
+                        unlink(opt_output.c_str());
+                    }
+                    return 1;
+                }
+                pl.segments(segs, filesize, hash);
+            }
+            pl.maxMemory(maxmemory);
+            ret = pl.key(key) != 0 ? -2 : pl.gather(fds, outfd, res);
+            if (maxmemory != 0 && ret != -5) {
+                cuilog::cout << cuilog::note("memory       : ") << pl.chunkSize() / 1024 << " KiB chunks per piece, "
+                             << pl.threads() << " worker(s)." << std::endl;
+            }
+            for (auto fd : fds) if (fd >= 0) close(fd);
+
+        }
+        if (outfd >= 0 && outfd != STDOUT_FILENO) {
+            close(outfd);
+            if (ret != 0) unlink(opt_output.c_str()); // never leave an unverified output behind
+        }
+        for (auto p : res.broken) {
+            cuilog::cout << cuilog::warn("Broken #") << p + 1 << " " << pieces[p] << " (digest mismatch)." << std::endl;
         }
-        std::vector<char> out;
-        ret = scatlib.gatherString(seps, 2336644, ma, out);
         if (ret == -1) {
             cuilog::cout << cuilog::crit("Error has occurred - some pieces has broken.") << std::endl;
             return 1;
         }
+        if (ret == -5) {
+            cuilog::cout << cuilog::crit("Error has occurred - memory budget is too small or memory is short.") << std::endl;
+            return 1;
+        }
         if (ret == -2) {
             cuilog::cout << cuilog::crit("Error has occurred - hashing failed.") << std::endl;
             return 1;
@@ -170,23 +526,114 @@ int main(int argc, char* argv[]) {
             cuilog::cout << cuilog::crit("Error has occurred - hash mismatch.") << std::endl;
             return 1;
         }
-        cuilog::cout << cuilog::note("Gathered ") << out.size() << " byte(s) file." << std::endl;
+        if (ret == -6) {
+            cuilog::cout << cuilog::crit("Error has occurred - the pieces need another key.") << std::endl;
+            return 1;
+        }
+        if (ret != 0) {
+            cuilog::cout << cuilog::crit("Error has occurred - could not write output.") << std::endl;
+            return 1;
+        }
+        if (opt_direct && !res.direct) {
+            cuilog::cout << cuilog::warn("Direct I/O is not supported here, used the page cache.") << std::endl;
+        }
+        for (auto p : res.rebuilt) {
+            cuilog::cout << cuilog::warn("Rebuilt #") << p + 1 << " from parity." << std::endl;
+        }
+        cuilog::cout << cuilog::note("Gathered ") << res.filesize << " byte(s) file." << std::endl;
+        cuilog::cout << cuilog::info("🐈 completed!") << std::endl;
+
+    } else if (opt_info) {
+
+        // make masks
+        std::vector<uint8_t> ma;
+        int ret = scatlib.makeMasks(ma, opt_piececnt);
+        if (ret != 0) {
+            cuilog::cout << cuilog::crit("Error has occurred - could not make masks.") << std::endl;
+            return 1;
+        }
 
-        // output
-        if (!opt_test) {
-            if (opt_output.size() != 0) {
-                cuilog::cout << cuilog::note("Writing ") << opt_output << "..." << std::endl;
-                std::ofstream ofile(opt_output);
-                ofile << std::string(out.begin(), out.end());
-                ofile.close();
-            } else {
-                std::cout << std::string(out.begin(), out.end());
+        // inspecting (piece tails, sizes and the stream trailer, not the bulk)
+        const char* formats[] = {"unknown", "stream", "framed", "legacy"};
+        const char* grains[] = {"bit", "nibble", "byte", "block"};
+        size_t failed = 0;
+        for (size_t i = 0; i < sets.size(); i++) {
+            std::vector<int> fds;
+            for (auto& pf : sets[i]) fds.push_back(open(pf.c_str(), O_RDONLY));
+            dscat::pipeline pl(ma, io, ex, &st);
+            pl.parity(opt_parity);
+            dscat::pipeline::info in;
+            ret = pl.key(key) != 0 ? -2 : pl.inspect(fds, in);
+            for (auto fd : fds) if (fd >= 0) close(fd);
+            bool consistent = ret == 0 && in.missing.empty() && in.inconsistent.empty();
+            if (!consistent) failed++;
+            cuilog::flush();
+            std::cout << (i == 0 ? opt_pieces : opt_sets[i - 1]) << ": format=" << formats[in.format] << " tails=" << in.version
+                      << " count=" << opt_piececnt << " parity=" << opt_parity << " interleave=" << grains[in.grain];
+            if (in.grain == dscat::scatlib::GRAIN_BLOCK) std::cout << ":" << in.width;
+            std::cout << " keyed=" << (in.keyed ? "yes" : "no") << (ret == -6 ? " key=wrong" : "") << " size=" << in.filesize
+                      << " piecesize=" << in.piecesize << " sha256=" << (in.hash.empty() ? "-" : in.hash)
+                      << " consistent=" << (consistent ? "yes" : "no");
+            for (auto m : in.missing) std::cout << " missing=" << m + 1;
+            for (auto m : in.inconsistent) std::cout << " mismatched=" << m + 1;
+            std::cout << std::endl;
+        }
+        if (failed != 0) {
+            cuilog::cout << cuilog::crit("Error has occurred - some pieces has broken.") << std::endl;
+            return 1;
+        }
+        cuilog::cout << cuilog::info("🐈 completed!") << std::endl;
+
+    } else {
+
+        // make masks
+        std::vector<uint8_t> ma;
+        int ret = scatlib.makeMasks(ma, opt_piececnt);
+        if (ret != 0) {
+            cuilog::cout << cuilog::crit("Error has occurred - could not make masks.") << std::endl;
+            return 1;
+        }
+
+        // verifying (sets stream through rebuild, gather and hash, no output)
+        dscat::verifier vf(ma, io, ex, &st);
+        vf.parity(opt_parity);
+        vf.maxMemory(maxmemory);
+        vf.jobs(static_cast<unsigned>(opt_jobs));
+        vf.key(key);
+        std::vector<dscat::verifier::report> reports;
+        std::mutex outmtx;
+        size_t failed = vf.run(sets, reports, [&](size_t i, const dscat::verifier::report& r) {
+            std::string why = r.ret == 0 ? "OK" : r.ret == -1 ? "FAILED (broken pieces)" : r.ret == -3 ? "FAILED (hash mismatch)"
+                              : r.ret == -5 ? "FAILED (memory budget is too small or memory is short)" : r.ret == -2 ? "FAILED (hashing failed)"
+                              : r.ret == -6 ? "FAILED (wrong key)"
+                              : "FAILED (read error)";
+            if (r.ret != 0 && (!r.broken.empty() || !r.missing.empty())) {
+                std::string which;
+                for (auto m : r.missing) which += (which.empty() ? "" : ",") + std::to_string(m + 1);
+                for (auto b : r.broken) which += (which.empty() ? "" : ",") + std::to_string(b + 1);
+                why = "FAILED (broken pieces: " + which + ")";
             }
-        } else {
-            cuilog::cout << cuilog::warn("Testing mode. No outputs.") << std::endl;
+            std::lock_guard<std::mutex> lk(outmtx);
+            for (auto m : r.missing) {
+                cuilog::cout << cuilog::warn("Missing #") << m + 1 << " " << sets[i][m] << "." << std::endl;
+            }
+            for (auto b : r.broken) {
+                cuilog::cout << cuilog::warn("Broken #") << b + 1 << " " << sets[i][b] << " (digest mismatch)." << std::endl;
+            }
+            for (auto p : r.rebuilt) {
+                cuilog::cout << cuilog::warn("Rebuilt #") << p + 1 << " of " << sets[i][0] << " from parity." << std::endl;
+            }
+            cuilog::flush();
+            std::cout << (i == 0 ? opt_pieces : opt_sets[i - 1]) << ": " << why << std::endl;
+        });
+        cuilog::cout << cuilog::note("Verified ") << sets.size() << " set(s), " << failed << " failed." << std::endl;
+        if (failed != 0) {
+            cuilog::cout << cuilog::crit("Error has occurred - some pieces has broken.") << std::endl;
+            return 1;
         }
         cuilog::cout << cuilog::info("🐈 completed!") << std::endl;
 
     }
+
     return 0;
 }
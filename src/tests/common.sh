@@ -0,0 +1,29 @@
+# shared by the test scripts
+#  usage: <script> <dscat binary> <fixture directory>
+#  a script counts its failures in `fail` and ends with `finish`
+
+D=$1
+DATA=$2
+T=$(mktemp -d "${TMPDIR:-/tmp}/dscat-test.XXXXXX")
+trap 'rm -rf "$T"' EXIT
+fail=0
+
+# comma split piece list: pieces <prefix> <count> -> $T/<prefix>1,...
+pieces() {
+    seq -s, -f "$T/$1%g" 1 "$2"
+}
+
+# report a failed check and go on
+failed() {
+    echo "FAIL: $*"
+    fail=$((fail + 1))
+}
+
+finish() {
+    if [ "$fail" -ne 0 ]; then
+        echo "$fail check(s) failed"
+        exit 1
+    fi
+    echo "all checks passed"
+    exit 0
+}
@@ -0,0 +1,19 @@
+#!/bin/bash
+# gather piece sets written by the first release (data/) back into data/input.txt
+. "$(dirname "$0")/common.sh"
+
+# <directory> <piece prefix> <count> <parity> [options]
+gather() {
+    local dir=$1 prefix=$2 c=$3 r=$4
+    shift 4
+    local P
+    P=$(seq -s, -f "$DATA/$dir/$prefix%g" 1 "$c")
+    [ "$r" -gt 0 ] && P="$P,$(seq -s, -f "$DATA/$dir/q%g" 1 "$r")"
+    "$D" -g -c "$c" -r "$r" -p "$P" "$@" | cmp -s - "$DATA/input.txt" || failed "$dir/$prefix c=$c r=$r $*"
+}
+
+# in-memory format of the first release (block_meta header, no tails)
+gather legacy c3p 3 0
+gather legacy c8p 8 0
+
+finish
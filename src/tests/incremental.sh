@@ -0,0 +1,57 @@
+#!/bin/bash
+# incremental scatting: unchanged chunks stay, the indexes keep the content to
+# themselves and the pieces do not grow without bound
+. "$(dirname "$0")/common.sh"
+
+P=$(pieces p 3),$(pieces q 1)
+scat() { "$D" -s -i -c 3 -r 1 --incremental -p "$P" -v < "$T/in" > "$T/log" 2>&1 || failed "scatter $1"; }
+check() {
+    "$D" -g -c 3 -r 1 --incremental -p "$P" -o "$T/out" > /dev/null 2>&1 || failed "gather $1"
+    cmp -s "$T/in" "$T/out" || failed "mismatch $1"
+    rm -f "$T/out"
+}
+
+head -c 3000000 /dev/urandom > "$T/in"
+scat first
+check first
+
+# an edit in the middle keeps most chunks
+printf 'edited' | dd of="$T/in" bs=1 seek=1500000 conv=notrunc 2>/dev/null
+scat edit
+grep -q ' unchanged' "$T/log" && ! grep -q ' 0 unchanged' "$T/log" || failed "no chunk reused"
+check edit
+
+# a NUL byte appended to a one chunk file (10001 bytes, the last group one
+# short) leaves its pieces alike, the length tells them apart (scattered
+# twice first, the second run drops the dead chunks of the previous file)
+head -c 10001 /dev/urandom > "$T/in"
+scat "odd size"
+scat "odd size again"
+printf '\0' >> "$T/in"
+scat "NUL appended"
+check "NUL appended"
+
+# neither the file hash nor its raw digest in an index
+sum=$(sha256sum < "$T/in" | cut -c1-64)
+for f in "$T"/p*.idx "$T"/q*.idx; do
+    grep -q "$sum" "$f" && failed "file hash in $f"
+    od -An -v -tx1 "$f" | tr -d ' \n' | grep -q "$sum" && failed "file digest in $f"
+done
+
+# one piece and its index lost
+mv "$T/p2" "$T/p2.bak"
+mv "$T/p2.idx" "$T/p2.idx.bak"
+check "without p2"
+mv "$T/p2.bak" "$T/p2"
+mv "$T/p2.idx.bak" "$T/p2.idx"
+
+# all new content each time: dead chunks get dropped
+for run in 1 2 3 4 5 6 7 8; do
+    head -c 3000000 /dev/urandom > "$T/in"
+    scat "new $run"
+    check "new $run"
+    [ "$(stat -c %s "$T/p1")" -le 3300000 ] || failed "piece grows, run $run"
+done
+ls "$T" | grep -q '\.tmp$' && failed "temporary files left"
+
+finish
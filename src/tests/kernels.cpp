@@ -0,0 +1,178 @@
+/*
+ * Copyright (c) 2018 https://github.com/dscat/cuitool
+ *
+ * Licensed under the MIT License: http://www.opensource.org/licenses/mit-license.php
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+// scatBlock and gatherBlock against a plain reference on random input, for
+// every piece count and interleave, keyed or not; built once per kernel
+// variant (as the CPU allows, without AVX-512, without SIMD), each printing a
+// digest of all its output for kernels.sh to compare
+
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+#include "../lib/scatlib.hpp"
+
+using dscat::scatlib;
+
+static int failures = 0;
+static uint64_t digest = 14695981039346656037ull; // fnv-1a of every output
+
+static void fold(const std::vector<char>& v) {
+    for (char c : v) digest = (digest ^ static_cast<uint8_t>(c)) * 1099511628211ull;
+}
+
+static void check(bool ok, const std::string& what) {
+    if (ok) return;
+    std::printf("FAIL: %s\n", what.c_str());
+    failures++;
+}
+
+// the tables of the masks, probed one byte at a time (a single group takes
+// the generic loop of the kernels)
+//  mt[p][r]: bits of stream byte r going to piece p, gt[k][p]: bits of piece p
+//  going to stream byte k
+static void tables(scatlib& lib, const std::vector<uint8_t>& ma, uint8_t (&mt)[8][8], uint8_t (&gt)[8][8]) {
+    const size_t cnt = ma.size();
+    std::vector<char> one(cnt), piece(cnt * 2);
+    std::vector<char*> dst(cnt);
+    std::vector<const char*> src(cnt);
+    for (size_t r = 0; r < cnt; r++) {
+        std::fill(one.begin(), one.end(), 0);
+        one[r] = static_cast<char>(0xff);
+        for (size_t p = 0; p < cnt; p++) dst[p] = &piece[p];
+        lib.scatBlock(one.data(), cnt, ma, dst.data());
+        for (size_t p = 0; p < cnt; p++) mt[p][r] = static_cast<uint8_t>(piece[p]);
+    }
+    for (size_t p = 0; p < cnt; p++) {
+        std::fill(piece.begin(), piece.end(), 0);
+        piece[p] = static_cast<char>(0xff);
+        for (size_t q = 0; q < cnt; q++) src[q] = &piece[q];
+        lib.gatherBlock(src.data(), 1, ma, one.data());
+        for (size_t k = 0; k < cnt; k++) gt[k][p] = static_cast<uint8_t>(one[k]);
+    }
+}
+
+// scatter and gather of `cnt` pieces through masks (stripe 0) or stripes
+static void run(scatlib& lib, const std::vector<uint8_t>& ma, size_t stripe, std::mt19937& rng, const std::string& name) {
+    const size_t cnt = ma.size(), unit = stripe == 0 ? 1 : stripe, group = cnt * unit;
+    uint8_t mt[8][8] = {}, gt[8][8] = {};
+    if (stripe == 0) tables(lib, ma, mt, gt);
+    for (size_t len : {size_t(0), size_t(1), cnt - 1, cnt * 16 + 3, cnt * 64 * unit, cnt * 1000 * unit + 7, size_t(200003)}) {
+        std::vector<char> in(len);
+        for (auto& c : in) c = static_cast<char>(rng());
+        const size_t groups = (len + group - 1) / group, plen = groups * unit;
+        std::vector<std::vector<char>> got(cnt, std::vector<char>(plen + 1, 'x')), want(cnt, std::vector<char>(plen + 1, 'x'));
+        std::vector<char*> dst(cnt);
+        for (size_t p = 0; p < cnt; p++) dst[p] = got[p].data();
+        lib.scatBlock(in.data(), len, ma, dst.data(), stripe);
+
+        // reference scatter, a short last group zero filled
+        std::vector<char> padded(in);
+        padded.resize(groups * group, 0);
+        for (size_t g = 0; g < groups; g++) {
+            for (size_t p = 0; p < cnt; p++) {
+                for (size_t i = 0; i < unit; i++) {
+                    uint8_t v = 0;
+                    if (stripe != 0) v = static_cast<uint8_t>(padded[g * group + p * unit + i]);
+                    else for (size_t r = 0; r < cnt; r++) v |= static_cast<uint8_t>(padded[g * cnt + r]) & mt[p][r];
+                    want[p][g * unit + i] = static_cast<char>(v);
+                }
+            }
+        }
+        check(got == want, name + " scatter len=" + std::to_string(len));
+        for (const auto& piece : got) fold(piece);
+
+        // reference gather of random pieces, and the round trip
+        if (stripe != 0 && plen % stripe != 0) continue;
+        for (auto& piece : got) {
+            for (size_t i = 0; i < plen; i++) piece[i] = static_cast<char>(rng());
+        }
+        std::vector<const char*> src(cnt);
+        for (size_t p = 0; p < cnt; p++) src[p] = got[p].data();
+        std::vector<char> out(plen * cnt + 1, 'x'), ref(plen * cnt + 1, 'x');
+        lib.gatherBlock(src.data(), plen, ma, out.data(), stripe);
+        for (size_t g = 0; g < groups; g++) {
+            for (size_t k = 0; k < cnt; k++) {
+                for (size_t i = 0; i < unit; i++) {
+                    uint8_t v = 0;
+                    if (stripe != 0) v = static_cast<uint8_t>(got[k][g * unit + i]);
+                    else for (size_t p = 0; p < cnt; p++) v |= static_cast<uint8_t>(got[p][g]) & gt[k][p];
+                    ref[(g * cnt + k) * unit + i] = static_cast<char>(v);
+                }
+            }
+        }
+        check(out == ref, name + " gather plen=" + std::to_string(plen));
+        fold(out);
+        lib.scatBlock(in.data(), len, ma, dst.data(), stripe);
+        lib.gatherBlock(src.data(), plen, ma, out.data(), stripe);
+        check(std::equal(in.begin(), in.end(), out.begin()), name + " round trip len=" + std::to_string(len));
+    }
+}
+
+int main() {
+    std::mt19937 rng(20181008);
+    const char* grains[] = {"bit", "nibble", "byte", "block"};
+    for (size_t cnt = 2; cnt <= 8; cnt++) {
+        for (int gr = scatlib::GRAIN_BIT; gr <= scatlib::GRAIN_BLOCK; gr++) {
+            const auto g = static_cast<scatlib::grain>(gr);
+            for (std::string key : {"", "kernel test key"}) {
+                scatlib lib;
+                std::vector<uint8_t> ma;
+                if (lib.makeMasks(ma, static_cast<int>(cnt), g) != 0) {
+                    check(false, "makeMasks c=" + std::to_string(cnt) + " " + grains[gr]);
+                    continue;
+                }
+                if (!key.empty() && lib.keySchedule(key, cnt, g) != 0) continue; // bit and nibble only
+                std::string name = std::string("c=") + std::to_string(cnt) + " " + grains[gr] + (key.empty() ? "" : " keyed");
+                if (g == scatlib::GRAIN_BLOCK) {
+                    for (size_t w : {size_t(2), size_t(16), size_t(4096)}) run(lib, ma, w, rng, name + ":" + std::to_string(w));
+                }
+                else {
+                    // bytes of 8 pieces go through the masks, the others stripe
+                    run(lib, ma, g == scatlib::GRAIN_BYTE && cnt != 8 ? 1 : 0, rng, name);
+                }
+
+                // the masks without a key, as the scatter formats define them
+                uint8_t mt[8][8], gt[8][8];
+                if (!key.empty() || (g == scatlib::GRAIN_BYTE && cnt != 8) || g == scatlib::GRAIN_BLOCK) continue;
+                tables(lib, ma, mt, gt);
+                bool same = true;
+                for (size_t p = 0; p < cnt; p++) {
+                    for (size_t r = 0; r < cnt; r++) same = same && mt[p][r] == ma[(p + cnt - r) % cnt] && gt[r][p] == mt[p][r];
+                }
+                check(same, name + " masks");
+            }
+        }
+    }
+    std::printf("kernels: %s\n", scatlib::kernels());
+    std::printf("digest: %016llx\n", static_cast<unsigned long long>(digest));
+    if (failures != 0) {
+        std::printf("%d check(s) failed\n", failures);
+        return 1;
+    }
+    std::printf("all checks passed\n");
+    return 0;
+}
@@ -0,0 +1,15 @@
+#!/bin/bash
+# the GFNI kernels give the very bytes of the scalar ones (skipped without GFNI)
+#  usage: kernels.sh <kernels binary> <kernels_scalar binary>
+fast=$("$1") || { echo "$fast"; exit 1; }
+slow=$("$2") || { echo "$slow"; exit 1; }
+if ! grep -qx "kernels: gfni" <<< "$fast"; then
+    echo "SKIP: $(grep '^kernels:' <<< "$fast")"
+    exit 77
+fi
+[ "$(grep '^digest:' <<< "$fast")" = "$(grep '^digest:' <<< "$slow")" ] || {
+    echo "FAIL: gfni and scalar output differ"
+    printf '%s\n%s\n' "$fast" "$slow"
+    exit 1
+}
+echo "gfni and scalar output agree"
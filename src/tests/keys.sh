@@ -0,0 +1,28 @@
+#!/bin/bash
+# keyed scatters (--key): round trips, and a wrong or missing key is refused
+. "$(dirname "$0")/common.sh"
+
+printf 'dscat test key\n' > "$T/key"
+printf 'another key\n' > "$T/wrong"
+head -c 1000003 /dev/urandom > "$T/in"
+for grain in bit nibble; do
+    for c in 2 3 8; do
+        P=$(pieces p "$c")
+        "$D" -s -i -c "$c" -p "$P" --interleave "$grain" --key "$T/key" < "$T/in" || failed "scatter $grain c=$c"
+        "$D" -g -c "$c" -p "$P" --key "$T/key" | cmp -s - "$T/in" || failed "gather $grain c=$c"
+        "$D" --verify -c "$c" -p "$P" --key "$T/key" > /dev/null 2>&1 || failed "verify $grain c=$c"
+        for k in "--key $T/wrong" ""; do
+            # shellcheck disable=SC2086
+            "$D" -g -c "$c" -p "$P" -o "$T/out" $k > /dev/null 2>&1 && failed "gather $grain c=$c passed with key '$k'"
+            [ -e "$T/out" ] && failed "output left with key '$k'"
+            # shellcheck disable=SC2086
+            "$D" --verify -c "$c" -p "$P" $k > /dev/null 2>&1 && failed "verify $grain c=$c passed with key '$k'"
+            rm -f "$T/out"
+        done
+        "$D" --info -p "$P" --key "$T/wrong" 2>/dev/null | grep -q " keyed=yes key=wrong " || failed "info $grain c=$c no key=wrong"
+        "$D" --info -p "$P" --key "$T/key" 2>/dev/null | grep -q " keyed=yes size=1000003 .* consistent=yes" || failed "info $grain c=$c"
+        rm -f "$T"/p*
+    done
+done
+
+finish
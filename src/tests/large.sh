@@ -0,0 +1,23 @@
+#!/bin/bash
+# a sparse 5 GiB file scattered into two pieces and gathered back (file
+# offsets past 32 bits, piece offsets past 31)
+#  exits 77 (skipped) without room for the pieces
+. "$(dirname "$0")/common.sh"
+
+size=$((5 * 1024 * 1024 * 1024))
+[ "$(df --output=avail -B1 "$T" | tail -1)" -gt $((size + (1 << 30))) ] || { echo "not enough space"; exit 77; }
+
+# random bytes at the start, across 4 GiB and at the end, holes between
+truncate -s "$size" "$T/in"
+for off in 0 $(((4 << 30) - 524288)) $((size - 1048576)); do
+    head -c 1048576 /dev/urandom | dd of="$T/in" bs=1M seek="$off" oflag=seek_bytes conv=notrunc 2>/dev/null
+done
+sum=$(sha256sum < "$T/in" | cut -c1-64)
+
+P=$(pieces p 2)
+"$D" -s -i -c 2 -p "$P" < "$T/in" > /dev/null 2>&1 || failed "scatter"
+rm -f "$T/in"
+"$D" --info -p "$P" | grep -q "size=$size piecesize=[0-9]* sha256=$sum consistent=yes" || failed "info"
+[ "$("$D" -g -c 2 -p "$P" 2>/dev/null | sha256sum | cut -c1-64)" = "$sum" ] || failed "gather"
+
+finish
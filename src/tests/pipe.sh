@@ -0,0 +1,19 @@
+#!/bin/bash
+# gather to stdout through relays that keep the pipe pages (splice) or copy them
+#  usage: pipe.sh <dscat binary> <fixture directory> <splicecat binary>
+. "$(dirname "$0")/common.sh"
+RELAY=$3
+
+head -c 67108864 /dev/urandom > "$T/in"
+sum=$(sha256sum < "$T/in")
+for c in 3 8; do
+    P=$(pieces p "$c")
+    "$D" -s -i -c "$c" -p "$P" < "$T/in" || failed "scatter c=$c"
+    for run in 1 2 3; do
+        [ "$("$D" -g -c "$c" -p "$P" | "$RELAY" | sha256sum)" = "$sum" ] || failed "splice relay c=$c run=$run"
+    done
+    [ "$("$D" -g -c "$c" -p "$P" | cat | sha256sum)" = "$sum" ] || failed "cat relay c=$c"
+    rm -f "$T"/p*
+done
+
+finish
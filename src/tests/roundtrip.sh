@@ -0,0 +1,61 @@
+#!/bin/bash
+# scatter and gather random inputs of awkward sizes for every piece count
+. "$(dirname "$0")/common.sh"
+
+for size in 0 1 7 79 80 81 131071 1048576 3000001; do
+    head -c "$size" /dev/urandom > "$T/in"
+    for c in 2 3 5 8; do
+        P=$(pieces p "$c")
+        "$D" -s -i -c "$c" -p "$P" < "$T/in" || failed "scatter size=$size c=$c"
+        "$D" -g -c "$c" -p "$P" -o "$T/out" || failed "gather size=$size c=$c"
+        cmp -s "$T/in" "$T/out" || failed "mismatch size=$size c=$c"
+        rm -f "$T"/p* "$T/out"
+    done
+done
+
+# every interleave and compressed frames, one piece lost and rebuilt from parity
+seq 1 300000 > "$T/text"
+for opts in "--interleave nibble" "--interleave byte" "--interleave 16" "--interleave 4K" "--compress lz4"; do
+    for c in 3 8; do
+        P=$(pieces p "$c"),$T/q1
+        # shellcheck disable=SC2086
+        "$D" -s -i -c "$c" -r 1 -p "$P" $opts < "$T/text" || failed "scatter $opts c=$c"
+        "$D" -g -c "$c" -r 1 -p "$P" | cmp -s - "$T/text" || failed "gather $opts c=$c"
+        rm -f "$T/p2"
+        "$D" -g -c "$c" -r 1 -p "$P" | cmp -s - "$T/text" || failed "gather $opts c=$c without p2"
+        rm -f "$T"/p* "$T"/q*
+    done
+done
+
+# stdout output and input from a pipe
+head -c 2000000 /dev/urandom > "$T/in"
+P=$(pieces p 4)
+cat "$T/in" | "$D" -s -i -c 4 -p "$P" || failed "scatter from a pipe"
+"$D" -g -c 4 -p "$P" | cmp -s - "$T/in" || failed "gather to stdout"
+
+# a corrupt piece fails and leaves no output behind
+printf 'X' | dd of="$T/p2" bs=1 seek=100 conv=notrunc 2>/dev/null
+"$D" -g -c 4 -p "$P" -o "$T/out" && failed "corruption not detected"
+[ -e "$T/out" ] && failed "unverified output left"
+# the numbers --stats asks for come out on a failure as well
+"$D" -g -c 4 -p "$P" -o "$T/out" --stats 2>&1 | grep -q "^total " || failed "no stats on a failed gather"
+rm -f "$T"/p*
+
+# with parity a piece failing its digest on the way is left out and the file
+# gathered again; stdout cannot start over, an unread parity piece is only
+# found by --verify
+P=$(pieces p 4),$T/q1
+"$D" -s -i -c 4 -r 1 -p "$P" < "$T/in" || failed "scatter with parity"
+printf 'X' | dd of="$T/p2" bs=1 seek=300000 conv=notrunc 2>/dev/null
+"$D" -g -c 4 -r 1 -p "$P" -o "$T/out" -v > "$T/log" 2>&1 || failed "gather around a broken piece"
+cmp -s "$T/in" "$T/out" || failed "mismatch around a broken piece"
+grep -q "Broken #.*2 $T/p2 " "$T/log" || failed "broken piece not named"
+rm -f "$T/out"
+"$D" -g -c 4 -r 1 -p "$P" > /dev/null 2>&1 && failed "gather to stdout passed a broken piece"
+"$D" -s -i -c 4 -r 1 -p "$P" < "$T/in" || failed "scatter with parity again"
+printf 'X' | dd of="$T/q1" bs=1 seek=300000 conv=notrunc 2>/dev/null
+"$D" -g -c 4 -r 1 -p "$P" | cmp -s - "$T/in" || failed "gather with a broken unread parity piece"
+"$D" --verify -c 4 -r 1 -p "$P" > "$T/log" 2>&1 && failed "verify passed a broken parity piece"
+grep -q "FAILED (broken pieces: 5)" "$T/log" || failed "verify did not name the parity piece"
+
+finish
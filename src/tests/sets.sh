@@ -0,0 +1,43 @@
+#!/bin/bash
+# pieces of two scatters of the same size are not one set: --verify, --info
+# and gathering name the odd ones out
+. "$(dirname "$0")/common.sh"
+
+head -c 100000 /dev/urandom > "$T/a"
+head -c 100000 /dev/urandom > "$T/b"
+"$D" -s -i -c 3 -r 1 -p "$(pieces a 3),$T/aq1" < "$T/a" > /dev/null 2>&1 || failed "scatter a"
+"$D" -s -i -c 3 -r 1 -p "$(pieces b 3),$T/bq1" < "$T/b" > /dev/null 2>&1 || failed "scatter b"
+"$D" --verify -c 3 -r 1 -p "$(pieces a 3),$T/aq1" > /dev/null 2>&1 || failed "verify a"
+
+# one piece of b among the pieces of a
+M="$T/a1,$T/b2,$T/a3,$T/aq1"
+"$D" --verify -c 3 -r 1 -p "$M" > "$T/log" 2>&1 && failed "verify passed a mixed set"
+grep -q "FAILED (broken pieces: 2)" "$T/log" || failed "verify did not name piece 2"
+"$D" --info -c 3 -r 1 -p "$M" > "$T/log" 2>&1 && failed "info passed a mixed set"
+grep -q "consistent=no" "$T/log" && grep -q "mismatched=2" "$T/log" || failed "info did not name piece 2"
+grep -q "sha256=$(sha256sum < "$T/a" | cut -c1-64) " "$T/log" || failed "info hash not the one of a"
+"$D" -g -c 3 -r 1 -p "$M" -o "$T/out" > /dev/null 2>&1 || failed "gather around piece 2"
+cmp -s "$T/a" "$T/out" || failed "mismatch around piece 2"
+rm -f "$T/out"
+
+# two of each, without parity
+M="$T/a1,$T/b2,$T/b3"
+"$D" --verify -c 3 -p "$M" > /dev/null 2>&1 && failed "verify passed two sets"
+"$D" -g -c 3 -p "$M" -o "$T/out" > /dev/null 2>&1 && failed "gathered two sets"
+[ -e "$T/out" ] && failed "output of two sets left"
+"$D" --info -c 3 -p "$M" > "$T/log" 2>&1 && failed "info passed two sets"
+grep -q "sha256=- consistent=no" "$T/log" || failed "info printed a hash of two sets"
+
+# the same without tails (cut off): nothing tells the pieces apart, the
+# trailer gathers into noise that must not show as a hash
+for f in a1 a2 a3 b1 b2 b3; do
+    cp "$T/$f" "$T/u$f"
+    truncate -s -184 "$T/u$f" # set record and piece tail
+done
+"$D" --info -c 3 -p "$T/ua1,$T/ua2,$T/ua3" > "$T/log" 2>&1 || failed "info without tails"
+grep -q "tails=0 .*sha256=$(sha256sum < "$T/a" | cut -c1-64) consistent=yes" "$T/log" || failed "info without tails: $(cat "$T/log")"
+"$D" --info -c 3 -p "$T/ua1,$T/ub2,$T/ua3" > "$T/log" 2>&1 && failed "info passed untagged pieces of two sets"
+grep -q "sha256=- consistent=no" "$T/log" || failed "info printed a noise hash"
+"$D" --verify -c 3 -p "$T/ua1,$T/ub2,$T/ua3" > /dev/null 2>&1 && failed "verify passed untagged pieces of two sets"
+
+finish
@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2018 https://github.com/dscat/cuitool
+ *
+ * Licensed under the MIT License: http://www.opensource.org/licenses/mit-license.php
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+// relay stdin (a pipe) to stdout with splice(2), like pv or a splice based
+// proxy: the pages move on to a pipe of its own, which is filled up before
+// it is passed on, so they stay referenced long after the writer let go
+
+#include <cerrno>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+
+int main() {
+    int hold[2];
+    if (pipe(hold) != 0) return 1;
+    fcntl(hold[1], F_SETPIPE_SZ, 1 << 20); // best effort
+    int cap = fcntl(hold[1], F_GETPIPE_SZ);
+    if (cap <= 0) return 1;
+    for (bool eof = false; !eof; ) {
+        ssize_t held = 0;
+        while (held < cap) {
+            ssize_t n = splice(STDIN_FILENO, nullptr, hold[1], nullptr, static_cast<size_t>(cap - held), SPLICE_F_MOVE);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) {
+                perror("splice");
+                return 1;
+            }
+            if (n == 0) {
+                eof = true;
+                break;
+            }
+            held += n;
+        }
+        usleep(1000); // the writer goes on meanwhile
+        while (held > 0) {
+            ssize_t n = splice(hold[0], nullptr, STDOUT_FILENO, nullptr, static_cast<size_t>(held), SPLICE_F_MOVE);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) {
+                perror("splice");
+                return 1;
+            }
+            held -= n;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,43 @@
+#!/bin/bash
+# piece store: files sharing chunks, a corrupt chunk restored from parity and
+# names that would leave the store
+. "$(dirname "$0")/common.sh"
+
+P=$(pieces s 3),$(pieces q 1)
+head -c 2000000 /dev/urandom > "$T/a"
+{ head -c 1000000 "$T/a"; head -c 500000 /dev/urandom; } > "$T/b"
+for f in a b; do
+    "$D" -s -i -c 3 -r 1 --store "$f" -p "$P" < "$T/$f" > /dev/null 2>&1 || failed "put $f"
+done
+for f in a b; do
+    "$D" -g -c 3 -r 1 --store "$f" -p "$P" -o "$T/out" > /dev/null 2>&1 || failed "get $f"
+    cmp -s "$T/$f" "$T/out" || failed "mismatch $f"
+    rm -f "$T/out"
+done
+
+# neither the file hash nor its raw digest in the store
+sum=$(sha256sum < "$T/a" | cut -c1-64)
+find "$T"/s* "$T"/q* -type f | grep -q "$sum" && failed "file hash in a chunk name"
+for f in "$T"/s*/recipes/a "$T"/q*/recipes/a; do
+    od -An -v -tx1 "$f" | tr -d ' \n' | grep -q "$sum" && failed "file digest in $f"
+done
+
+# a flipped byte in a data chunk is caught and rebuilt
+c=$(find "$T/s2/chunks" -type f | head -1)
+printf 'X' | dd of="$c" bs=1 seek=10 conv=notrunc 2>/dev/null
+broken=0
+for f in a b; do
+    "$D" -g -c 3 -r 1 --store "$f" -p "$P" -o "$T/out" -v > "$T/log" 2>&1 || failed "get $f with a corrupt chunk"
+    cmp -s "$T/$f" "$T/out" || failed "mismatch $f with a corrupt chunk"
+    grep -q "Broken #.*2 $T/s2 " "$T/log" && broken=1
+    rm -f "$T/out"
+done
+[ "$broken" -eq 1 ] || failed "corrupt chunk not reported"
+
+# names outside the recipes directory
+for name in ../x a/b . ..; do
+    "$D" -s -i -c 3 -r 1 --store "$name" -p "$P" < "$T/a" > /dev/null 2>&1 && failed "put accepted $name"
+done
+[ -e "$T/x" ] && failed "wrote outside the store"
+
+finish